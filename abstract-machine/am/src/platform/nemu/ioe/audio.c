@@ -10,6 +10,24 @@
 #define AUDIO_WPTR_ADDR     (AUDIO_ADDR + 0x18)
 #define AUDIO_RPTR_ADDR     (AUDIO_ADDR + 0x1c)
 
+// Copy into the stream buffer a word at a time, so that each MMIO access
+// moves 4 bytes instead of 1.
+static void sbuf_write(uint32_t off, const uint8_t* src, uint32_t n)
+{
+    while (n > 0 && (off & 3) != 0)
+    {
+        outb(AUDIO_SBUF_ADDR + off++, *src++);
+        n--;
+    }
+    for (; n >= 4; n -= 4, off += 4, src += 4)
+        outl(AUDIO_SBUF_ADDR + off, src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24));
+    while (n > 0)
+    {
+        outb(AUDIO_SBUF_ADDR + off++, *src++);
+        n--;
+    }
+}
+
 void __am_audio_init()
 {
 }
@@ -46,27 +64,19 @@ void __am_audio_play(AM_AUDIO_PLAY_T* ctl)
             break;
     }
 
+    // `wptr` counts bytes without wrapping, so writing a whole buffer still moves it.
     uint32_t wptr = inl(AUDIO_WPTR_ADDR);
-    uint32_t first_chunk = sbuf_size - wptr;
+    uint32_t off = wptr % sbuf_size;
+    uint32_t first_chunk = sbuf_size - off;
     uint8_t* src = (uint8_t*)ctl->buf.start;
 
     if ((uint32_t)len <= first_chunk)
-    {
-        for (int i = 0; i < len; i++)
-            outb(AUDIO_SBUF_ADDR + wptr + i, src[i]);
-    }
+        sbuf_write(off, src, len);
     else
     {
-        uint32_t n1 = first_chunk;
-        uint32_t n2 = len - n1;
-        for (uint32_t i = 0; i < n1; i++)
-            outb(AUDIO_SBUF_ADDR + wptr + i, src[i]);
-
-        for (uint32_t i = 0; i < n2; i++)
-        {
-            outb(AUDIO_SBUF_ADDR + i, src[n1 + i]);
-        }
+        sbuf_write(off, src, first_chunk);
+        sbuf_write(0, src + first_chunk, len - first_chunk);
     }
 
-    outl(AUDIO_WPTR_ADDR, (wptr + len) % sbuf_size);
+    outl(AUDIO_WPTR_ADDR, wptr + len);
 }
@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BTRACE_DEF_H__
+#define __BTRACE_DEF_H__
+
+#include <stdint.h>
+
+// Binary trace format, shared by NEMU and tools/btrace-decoder.
+// A file is a `btrace_header_t` followed by fixed-size `btrace_rec_t`s.
+
+#define BTRACE_MAGIC "NEMUBTR"
+#define BTRACE_VERSION 1
+
+enum {
+  BTRACE_INST,       // pc, data = instruction
+  BTRACE_MEM_READ,   // pc, addr, len, data
+  BTRACE_MEM_WRITE,  // pc, addr, len, data
+  BTRACE_DEV_READ,   // pc, addr, len, data
+  BTRACE_DEV_WRITE,  // pc, addr, len, data
+  BTRACE_NR_TYPE
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t rec_size;
+} btrace_header_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t len;
+  uint16_t pad;
+  uint32_t pc;
+  uint64_t icount;
+  uint32_t addr;
+  uint32_t data;
+} btrace_rec_t;
+
+#endif
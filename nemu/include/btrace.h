@@ -0,0 +1,28 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BTRACE_H__
+#define __BTRACE_H__
+
+#include <common.h>
+#include <btrace-def.h>
+
+#ifdef CONFIG_TRACE_BINARY
+void init_btrace(const char *log_file);
+void btrace_emit(uint8_t type, uint8_t len, vaddr_t pc, paddr_t addr, word_t data);
+void btrace_flush();
+#endif
+
+#endif
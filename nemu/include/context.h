@@ -0,0 +1,63 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/event.h>
+
+// Guest-visible state of the emulator. The names used all over NEMU
+// (`cpu`, `nemu_state`, ...) are macros into it, so that a REF can reset
+// everything at once for nemu_create(), see difftest/ref.c.
+typedef struct NEMUContext {
+  CPU_state cpu;
+  NEMUState state;
+  uint64_t nr_guest_inst;
+  uint64_t timer; // host time spent in cpu_exec(), us
+  uint8_t *pmem;
+
+#ifdef CONFIG_DEVICE
+  uint64_t next_event;
+  event_t events[MAX_EVENT];
+  int nr_event;
+
+  uint8_t *io_space;
+  uint8_t *p_space;
+  IOMap mmio_maps[NR_MAP];
+  int nr_mmio_map;
+#endif
+
+#ifdef CONFIG_HAS_YSYXSOC
+  uint8_t *ysyxsoc_uart;
+#endif
+} NEMUContext;
+
+#define NEMU_CTX_INIT { \
+  .state = { .state = NEMU_STOP }, \
+  IFDEF(CONFIG_DEVICE, .next_event = UINT64_MAX,) \
+}
+
+extern NEMUContext nemu_ctx_default;
+#define NEMU_CTX nemu_ctx_default
+
+#define cpu             (NEMU_CTX.cpu)
+#define nemu_state      (NEMU_CTX.state)
+#define g_nr_guest_inst (NEMU_CTX.nr_guest_inst)
+#define g_timer         (NEMU_CTX.timer)
+#define g_next_event    (NEMU_CTX.next_event)
+
+#endif
@@ -0,0 +1,37 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+// Device events are keyed on the number of guest instructions executed,
+// so the interpreter loop only needs to compare `g_nr_guest_inst` with
+// `g_next_event` to know whether there is anything to do.
+typedef void (*event_handler_t) ();
+
+#define MAX_EVENT 8
+
+typedef struct {
+  uint64_t deadline;
+  uint64_t period;
+  event_handler_t handler;
+} event_t;
+
+void add_event_handle(uint64_t period, event_handler_t h);
+void device_run_events();
+
+#endif
@@ -18,8 +18,14 @@
 
 #include <cpu/difftest.h>
 
+#define NR_MAP 16
+
+// 512 MB, only the pages of mapped devices are ever touched
+#define IO_SPACE_MAX (512 * 1024 * 1024)
+
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+uint8_t* io_space_used(size_t *size);
 
 typedef struct {
   const char *name;
@@ -29,13 +29,14 @@ extern unsigned char isa_logo[];
 void init_isa();
 
 // reg
-extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+word_t *isa_reg_str2ptr(const char *name);
 
 // csr
 void isa_csr_display();
 word_t isa_csr_str2val(const char *name, bool *success);
+word_t *isa_csr_str2ptr(const char *name);
 
 // exec
 struct Decode;
@@ -67,9 +68,12 @@ word_t isa_query_intr();
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
 void isa_difftest_attach();
 
-// function trace
-#ifdef CONFIG_FTRACE
+// function trace, `buf` may be NULL to only update the shadow call stack
+#ifdef CONFIG_CALL_TRACK
 int isa_ftrace_dump(struct Decode *s, char *buf, size_t buf_size);
 #endif
 
+// `cpu` lives in the current context
+#include <context.h>
+
 #endif
@@ -31,6 +31,11 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* allocate host memory backing guest memory or device spaces; pages are
+ * zero-filled on first touch */
+uint8_t* host_mem_alloc(size_t size);
+void host_mem_free(uint8_t *p, size_t size);
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
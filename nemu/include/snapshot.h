@@ -0,0 +1,31 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <common.h>
+
+// Devices with state outside of their MMIO space register a fixed-size
+// blob, which is saved and restored together with the machine.
+typedef void (*snapshot_save_t)(void *buf);
+typedef void (*snapshot_load_t)(const void *buf);
+
+void add_snapshot_handle(size_t size, snapshot_save_t save, snapshot_load_t load);
+
+bool snapshot_save(const char *path);
+bool snapshot_load(const char *path);
+
+#endif
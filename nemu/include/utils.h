@@ -28,8 +28,6 @@ typedef struct {
   uint32_t halt_ret;
 } NEMUState;
 
-extern NEMUState nemu_state;
-
 // ----------- timer -----------
 
 uint64_t get_time();
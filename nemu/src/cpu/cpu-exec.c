@@ -18,6 +18,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/event.h>
+#include <btrace.h>
 
 #include <memory/vaddr.h>
 
@@ -31,26 +33,60 @@
 #define MAX_INST_TO_PRINT 10
 
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
-static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
 void wp_update();
 void bp_update();
+void ftrace_profile_display(uint64_t icount);
+void audio_statistic();
+
+#ifdef CONFIG_PROFILE
+// Instructions executed at each pc in pmem, indexed by (pc - MBASE) >> 1 so
+// that compressed instructions get their own slot. The array is calloc'ed,
+// so only the pages backing executed code are ever touched. Everything is
+// folded into functions when the program ends.
+#define PROFILE_NR_SLOT (CONFIG_MSIZE >> 1)
+static uint64_t *prof_count = NULL;
+static uint64_t prof_outside = 0;
+
+static inline void profile_count(vaddr_t pc) {
+  uint64_t idx = (uint64_t)(pc - CONFIG_MBASE) >> 1;
+  if (likely(idx < PROFILE_NR_SLOT)) prof_count[idx] ++;
+  else prof_outside ++;
+}
+
+static void profile_dump() {
+  void ftrace_profile_add_pc(uint32_t pc, uint64_t count);
+  void ftrace_profile_write(const char *prefix, uint64_t icount);
+  if (prof_count == NULL) return;
+  for (uint64_t i = 0; i < PROFILE_NR_SLOT; i ++) {
+    if (prof_count[i]) ftrace_profile_add_pc(CONFIG_MBASE + (i << 1), prof_count[i]);
+  }
+  if (prof_outside) Log("profile: %" PRIu64 " instructions outside pmem", prof_outside);
+  ftrace_profile_write(CONFIG_PROFILE_OUTPUT, g_nr_guest_inst);
+  free(prof_count);
+  prof_count = NULL;
+}
+#endif
 
 #ifdef CONFIG_ITRACE
+// Only raw (pc, inst) pairs are recorded. They are disassembled when the
+// ring buffer is displayed or the trace is written.
 #define IRINGBUF_SZ 16
-#define IRINGBUF_ENTRY_SZ sizeof(((Decode*)0)->logbuf)
 struct ringbuf_t {
-  char *buf[IRINGBUF_SZ][IRINGBUF_ENTRY_SZ];
+  struct {
+    word_t pc;
+    uint32_t inst;
+  } buf[IRINGBUF_SZ];
   int rptr;
   int wptr;
+  // The newest entry has been pushed, but its instruction is not committed yet.
+  bool pending;
 } g_iringbuf = {
   .buf = {},
   .rptr = 0,
-  .wptr = 0
+  .wptr = 0,
+  .pending = false
 };
 
 static void disasm_and_dump(word_t pc, word_t snpc, uint8_t *inst, char* dest, size_t bufsz) {
@@ -76,35 +112,61 @@ static void disasm_and_dump(word_t pc, word_t snpc, uint8_t *inst, char* dest, s
   disassemble(p, dest + bufsz - p, MUXDEF(CONFIG_ISA_x86, snpc, pc), inst, ilen);
 }
 
-static void iringbuf_push(word_t pc, word_t inst) {
-  disasm_and_dump(pc, pc + 4, (uint8_t*)&inst, (char*)g_iringbuf.buf[g_iringbuf.wptr], IRINGBUF_ENTRY_SZ);
+// Attention: Push before exec to catch the inst causing the failure.
+static void iringbuf_push(word_t pc) {
+  g_iringbuf.buf[g_iringbuf.wptr].pc = pc;
+  g_iringbuf.pending = true;
   g_iringbuf.wptr = (g_iringbuf.wptr + 1) % IRINGBUF_SZ;
   if (g_iringbuf.wptr == g_iringbuf.rptr)
     g_iringbuf.rptr = (g_iringbuf.rptr + 1) % IRINGBUF_SZ;
 }
 
-// TODO: try to move `pc` to the middle of the ring buffer.
-static void iringbuf_update(word_t pc) {
-  word_t inst = vaddr_ifetch(pc, 4);
-  iringbuf_push(pc, inst);
+static void iringbuf_commit(uint32_t inst) {
+  g_iringbuf.buf[(g_iringbuf.wptr + IRINGBUF_SZ - 1) % IRINGBUF_SZ].inst = inst;
+  g_iringbuf.pending = false;
 }
 
 void iringbuf_display() {
+  int last = (g_iringbuf.wptr + IRINGBUF_SZ - 1) % IRINGBUF_SZ;
   for (int i = g_iringbuf.rptr; i != g_iringbuf.wptr; i = (i + 1) % IRINGBUF_SZ) {
-    if (i == g_iringbuf.wptr - 1)
-      printf("%s <<<<<<<<<<<<<<<<<<<\n", (char *)g_iringbuf.buf[i]);
+    word_t pc = g_iringbuf.buf[i].pc;
+    uint32_t inst = g_iringbuf.buf[i].inst;
+    char buf[128];
+    // Failed in the middle of the newest instruction. Read it from pmem
+    // directly: refetching would fail again for a bad pc and recurse here.
+    bool fetched = true;
+    if (i == last && g_iringbuf.pending) {
+      fetched = in_pmem(pc) && in_pmem(pc + 3);
+      if (fetched) memcpy(&inst, guest_to_host(pc), sizeof(inst));
+    }
+    if (fetched) disasm_and_dump(pc, pc + 4, (uint8_t *)&inst, buf, sizeof(buf));
+    else snprintf(buf, sizeof(buf), FMT_WORD ": <fetch failed>", pc);
+    if (i == last)
+      printf("%s <<<<<<<<<<<<<<<<<<<\n", buf);
     else
-      printf("%s\n", (char *)g_iringbuf.buf[i]);
+      printf("%s\n", buf);
   }
 }
 #endif
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+#ifdef CONFIG_ITRACE
+  extern bool log_enable();
+  bool do_log = false;
 #ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+  do_log = ITRACE_COND && log_enable();
+#endif
+#ifdef CONFIG_TRACE_BINARY
+  if (do_log) btrace_emit(BTRACE_INST, _this->snpc - _this->pc, _this->pc, 0, _this->isa.inst);
+  do_log = false;
+#endif
+  if (do_log || g_print_step) {
+    char logbuf[128];
+    disasm_and_dump(_this->pc, _this->snpc, (uint8_t *)&_this->isa.inst, logbuf, sizeof(logbuf));
+    if (do_log) { log_write("%s\n", logbuf); }
+    if (g_print_step) { puts(logbuf); }
+  }
 #endif
-
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
 
 #ifdef CONFIG_FTRACE
   char buf[256];
@@ -114,6 +176,9 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
     if (g_print_step)
       printf("FTRACE: %s\n", buf);
   }
+#elif defined(CONFIG_PROFILE)
+  // The profiler only needs the shadow call stack, not the text log.
+  isa_ftrace_dump(_this, NULL, 0);
 #endif
 
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
@@ -126,14 +191,11 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 
 static void exec_once(Decode *s, vaddr_t pc) {
 #ifdef CONFIG_ITRACE
-  uint8_t* inst = (uint8_t *)&s->isa.inst;
-
-  // Attention: Update Inst Ring Buffer before exec to catch the inst causing the failure.
-  // However, before isa_exec_once, we don't know the `snpc` for x86, so `iringbuf_write_one`
-  // only works on riscv.
+  // Before isa_exec_once, we don't know the `snpc` for x86, so the
+  // Inst Ring Buffer only works on riscv.
   // FIXME: support x86.
 #ifdef CONFIG_ISA_riscv
-  iringbuf_update(pc);
+  iringbuf_push(pc);
 #else
 #pragma message("Inst Ring Buffer on this ISA is not supported yet.")
 #endif
@@ -144,20 +206,31 @@ static void exec_once(Decode *s, vaddr_t pc) {
   isa_exec_once(s);
   
   cpu.pc = s->dnpc;
-  IFDEF(CONFIG_ITRACE, disasm_and_dump(s->pc, s->snpc, inst, s->logbuf, sizeof(s->logbuf)));
+  IFDEF(CONFIG_ISA_riscv, IFDEF(CONFIG_ITRACE, iringbuf_commit(s->isa.inst)));
 }
 
-static void execute(uint64_t n) {
+// `stop_pc` is never a valid pc unless it is set by cpu_exec_until().
+#define NO_STOP_PC ((vaddr_t)-1)
+
+// Inlined into execute() and execute_until() with `until` constant, so the
+// loop of cpu_exec() does not compare against `stop_pc` at all.
+static inline __attribute__((always_inline)) void execute_loop(uint64_t n, bool until, vaddr_t stop_pc) {
   Decode s;
   for (;n > 0; n --) {
+    if (until && cpu.pc == stop_pc) break;
+    IFDEF(CONFIG_PROFILE, profile_count(cpu.pc));
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, if (g_nr_guest_inst >= g_next_event) device_run_events());
   }
 }
 
+static void execute(uint64_t n) { execute_loop(n, false, 0); }
+
+static void execute_until(uint64_t n, vaddr_t stop_pc) { execute_loop(n, true, stop_pc); }
+
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
@@ -165,16 +238,17 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_HAS_AUDIO, audio_statistic());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_TRACE_BINARY, btrace_flush());
   IFDEF(CONFIG_ITRACE, iringbuf_display());
   isa_reg_display();
   statistic();
 }
 
-/* Simulate how the CPU works. */
-void cpu_exec(uint64_t n) {
+static void cpu_exec_internal(uint64_t n, vaddr_t stop_pc) {
   g_print_step = (n < MAX_INST_TO_PRINT);
   switch (nemu_state.state) {
     case NEMU_END: case NEMU_ABORT: case NEMU_QUIT:
@@ -183,9 +257,17 @@ void cpu_exec(uint64_t n) {
     default: nemu_state.state = NEMU_RUNNING;
   }
 
+#ifdef CONFIG_PROFILE
+  if (prof_count == NULL) {
+    prof_count = calloc(PROFILE_NR_SLOT, sizeof(uint64_t));
+    Assert(prof_count != NULL, "profile: out of memory");
+  }
+#endif
+
   uint64_t timer_start = get_time();
 
-  execute(n);
+  if (stop_pc == NO_STOP_PC) execute(n);
+  else execute_until(n, stop_pc);
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -194,12 +276,26 @@ void cpu_exec(uint64_t n) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
 
     case NEMU_END: case NEMU_ABORT:
+      IFDEF(CONFIG_TRACE_BINARY, if (nemu_state.state == NEMU_ABORT) btrace_flush());
       Log("nemu: %s at pc = " FMT_WORD,
           (nemu_state.state == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) :
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
       // fall through
-    case NEMU_QUIT: statistic();
+    case NEMU_QUIT:
+      IFDEF(CONFIG_FTRACE, ftrace_profile_display(g_nr_guest_inst));
+      IFDEF(CONFIG_PROFILE, profile_dump());
+      statistic();
   }
 }
+
+/* Simulate how the CPU works. */
+void cpu_exec(uint64_t n) {
+  cpu_exec_internal(n, NO_STOP_PC);
+}
+
+/* Same as cpu_exec(), but stops before executing the instruction at `pc`. */
+void cpu_exec_until(vaddr_t pc, uint64_t n) {
+  cpu_exec_internal(n, pc);
+}
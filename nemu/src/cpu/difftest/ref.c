@@ -21,7 +21,7 @@
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
 
-__EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+static void ref_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF)
     copy_to_paddr(addr, buf, n);
   else
@@ -34,7 +34,7 @@ struct diff_context_t {
   word_t csr[4096];
 };
 
-__EXPORT void difftest_regcpy(void *dut, bool direction) {
+static void ref_regcpy(void *dut, bool direction) {
   struct diff_context_t *ctx = (struct diff_context_t *)dut;
   if (direction == DIFFTEST_TO_REF) {
     cpu.pc = ctx->pc;
@@ -59,11 +59,9 @@ __EXPORT void difftest_regcpy(void *dut, bool direction) {
   }
 }
 
-__EXPORT void difftest_exec(uint64_t n) { cpu_exec(n); }
-
-__EXPORT void difftest_raise_intr(word_t NO) { assert(0); }
+static void ref_raise_intr(word_t NO) { assert(0); }
 
-__EXPORT void difftest_init(int port) {
+static void init_instance() {
   void init_mem();
   init_mem();
   /* Perform ISA dependent initialization. */
@@ -73,6 +71,95 @@ __EXPORT void difftest_init(int port) {
   init_device();
 }
 
+/* There is one machine per process: every guest-visible name is a macro into
+ * `nemu_ctx_default` (see context.h), and host-side state such as the trace
+ * buffers and tracesim is global too. The nemu_*() interface only lets a
+ * host start over with a fresh machine and tear it down again, so at most
+ * one of difftest_init() and nemu_create() may be live. Once difftest_init()
+ * or difftest_tracesim_init() is called, the machine stays with it.
+ */
+static enum { LIVE_NONE, LIVE_DIFFTEST, LIVE_CREATED } live = LIVE_NONE;
+
+static void enter_default() {
+  Assert(live != LIVE_CREATED, "difftest_*() can not be used while an instance from nemu_create() is live");
+  live = LIVE_DIFFTEST;
+}
+
+__EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+  ref_memcpy(addr, buf, n, direction);
+}
+
+__EXPORT void difftest_regcpy(void *dut, bool direction) {
+  ref_regcpy(dut, direction);
+}
+
+__EXPORT void difftest_exec(uint64_t n) {
+  cpu_exec(n);
+}
+
+__EXPORT void difftest_raise_intr(word_t NO) {
+  ref_raise_intr(NO);
+}
+
+__EXPORT void difftest_init(int port) {
+  enter_default();
+  init_instance();
+}
+
+#ifdef CONFIG_TARGET_SHARE
+/* Handle-based interface. The handle is always the one machine, it only
+ * marks which caller owns it. Not reentrant: call from one thread at a time.
+ * nemu_create() returns NULL while the machine is live.
+ */
+__EXPORT NEMUContext *nemu_create() {
+  if (live != LIVE_NONE) {
+    Log("nemu_create: the REF is already in use");
+    return NULL;
+  }
+  nemu_ctx_default = (NEMUContext) NEMU_CTX_INIT;
+  nemu_ctx_default.pmem = host_mem_alloc(CONFIG_MSIZE);
+  init_instance();
+  live = LIVE_CREATED;
+  return &nemu_ctx_default;
+}
+
+__EXPORT void nemu_destroy(NEMUContext *ctx) {
+  assert(ctx == &nemu_ctx_default && live == LIVE_CREATED);
+  host_mem_free(ctx->pmem, CONFIG_MSIZE);
+  IFDEF(CONFIG_DEVICE, host_mem_free(ctx->io_space, IO_SPACE_MAX));
+  *ctx = (NEMUContext) NEMU_CTX_INIT;
+  live = LIVE_NONE;
+}
+
+__EXPORT void nemu_memcpy(NEMUContext *ctx, paddr_t addr, void *buf, size_t n, bool direction) {
+  assert(ctx == &nemu_ctx_default);
+  ref_memcpy(addr, buf, n, direction);
+}
+
+__EXPORT void nemu_regcpy(NEMUContext *ctx, void *dut, bool direction) {
+  assert(ctx == &nemu_ctx_default);
+  ref_regcpy(dut, direction);
+}
+
+__EXPORT void nemu_exec(NEMUContext *ctx, uint64_t n) {
+  assert(ctx == &nemu_ctx_default);
+  cpu_exec(n);
+}
+
+// Runs at most `n` instructions, stopping before the one at `pc`.
+// Returns NEMU_STOP, or the state the program ended in.
+__EXPORT int nemu_exec_until(NEMUContext *ctx, vaddr_t pc, uint64_t n) {
+  assert(ctx == &nemu_ctx_default);
+  cpu_exec_until(pc, n);
+  return nemu_state.state;
+}
+
+__EXPORT void nemu_raise_intr(NEMUContext *ctx, word_t NO) {
+  assert(ctx == &nemu_ctx_default);
+  ref_raise_intr(NO);
+}
+#endif
+
 struct tracesim_batch {
   // PC stream
   uint32_t *i_stream;
@@ -100,6 +187,7 @@ struct tracesim_batch {
 bool in_difftest_tracesim;
 static uint32_t tracesim_batch_size;
 __EXPORT void difftest_tracesim_init(uint32_t batch_size) {
+  enter_default();
   tracesim_batch_size = batch_size;
   in_difftest_tracesim = true;
 }
@@ -15,7 +15,9 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <snapshot.h>
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 enum {
   reg_freq = 0,
@@ -32,27 +34,63 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/* The stream buffer is a single-producer/single-consumer ring. The guest
+ * produces by filling sbuf and then writing `wptr`, the SDL audio thread
+ * consumes in the callback. `wpos`/`rpos` count bytes monotonically and are
+ * exposed as is through `wptr`/`rptr`, so the guest writes `wptr + len` and
+ * a write of a whole buffer is distinguishable from no write. The offset into
+ * sbuf is the counter modulo CONFIG_SB_SIZE.
+ */
+_Static_assert((CONFIG_SB_SIZE & (CONFIG_SB_SIZE - 1)) == 0,
+               "CONFIG_SB_SIZE must be a power of two, the counters wrap at 2^32");
+
+static _Atomic uint32_t wpos = 0; // advanced by the guest
+static _Atomic uint32_t rpos = 0; // advanced by the SDL callback
+static atomic_bool started = false;
+static _Atomic uint64_t nr_underrun = 0;
+static uint64_t nr_overrun = 0;
+
 static void sdl_audio_callback(void *userdata, uint8_t *stream, int len) {
-  uint32_t wptr = audio_base[reg_wptr];
-  uint32_t rptr = audio_base[reg_rptr];
-  uint32_t sbuf_size = audio_base[reg_sbuf_size];
+  uint32_t r = atomic_load_explicit(&rpos, memory_order_relaxed);
+  uint32_t w = atomic_load_explicit(&wpos, memory_order_acquire);
 
-  // available = (wptr - rptr + sbuf_size) % sbuf_size
-  uint32_t available = (wptr + sbuf_size - rptr) % sbuf_size;
+  uint32_t available = w - r;
+  if (available > CONFIG_SB_SIZE) available = CONFIG_SB_SIZE;
   uint32_t to_copy = (uint32_t)len <= available ? (uint32_t)len : available;
 
-  uint32_t first_chunk = sbuf_size - rptr;
+  uint32_t off = r % CONFIG_SB_SIZE;
+  uint32_t first_chunk = CONFIG_SB_SIZE - off;
   if (to_copy <= first_chunk)
-    memcpy(stream, sbuf + rptr, to_copy);
+    memcpy(stream, sbuf + off, to_copy);
   else {
-    memcpy(stream, sbuf + rptr, first_chunk);
+    memcpy(stream, sbuf + off, first_chunk);
     memcpy(stream + first_chunk, sbuf, to_copy - first_chunk);
   }
 
-  if ((uint32_t)len > to_copy)
+  if ((uint32_t)len > to_copy) {
     memset(stream + to_copy, 0, len - to_copy);
+    // Silence before the first sample is not an underrun.
+    if (atomic_load_explicit(&started, memory_order_relaxed))
+      atomic_fetch_add_explicit(&nr_underrun, 1, memory_order_relaxed);
+  }
+
+  atomic_store_explicit(&rpos, r + to_copy, memory_order_release);
+}
+
+static inline uint32_t audio_count() {
+  uint32_t n = atomic_load_explicit(&wpos, memory_order_relaxed) -
+               atomic_load_explicit(&rpos, memory_order_acquire);
+  return n > CONFIG_SB_SIZE ? CONFIG_SB_SIZE : n;
+}
 
-  audio_base[reg_rptr] = (rptr + to_copy) % sbuf_size;
+// The guest has written sbuf up to the new `wptr`; publish it to the consumer.
+static void audio_push(uint32_t new_wptr) {
+  uint32_t w = atomic_load_explicit(&wpos, memory_order_relaxed);
+  uint32_t advance = new_wptr - w;
+  if (advance == 0) return;
+  if (audio_count() + advance > CONFIG_SB_SIZE) nr_overrun ++;
+  atomic_store_explicit(&wpos, new_wptr, memory_order_release);
+  atomic_store_explicit(&started, true, memory_order_relaxed);
 }
 
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
@@ -60,19 +98,26 @@ static void audio_io_handler(uint32_t offset, int len, bool is_write) {
   case reg_freq << 2:
   case reg_channels << 2:
   case reg_samples << 2:
-  case reg_wptr << 2:
     // pass
     break;
 
+  case reg_wptr << 2:
+    if (is_write) audio_push(audio_base[reg_wptr]);
+    else audio_base[reg_wptr] = atomic_load_explicit(&wpos, memory_order_relaxed);
+    break;
+
   case reg_sbuf_size << 2:
+    Assert(!is_write, "write to read-only register.");
+    break;
+
   case reg_rptr << 2:
     Assert(!is_write, "write to read-only register.");
+    audio_base[reg_rptr] = atomic_load_explicit(&rpos, memory_order_acquire);
     break;
 
-  case reg_count << 2: {
+  case reg_count << 2:
     Assert(!is_write, "write to read-only register.");
-    audio_base[reg_count] = (audio_base[reg_wptr] + CONFIG_SB_SIZE - audio_base[reg_rptr]) % CONFIG_SB_SIZE;
-  }
+    audio_base[reg_count] = audio_count();
     break;
 
   case reg_init << 2: {
@@ -95,6 +140,29 @@ static void audio_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+void audio_statistic() {
+  if (!atomic_load(&started)) return;
+  Log("audio underruns = %" PRIu64 ", overruns = %" PRIu64,
+      atomic_load(&nr_underrun), nr_overrun);
+}
+
+typedef struct {
+  uint32_t wpos, rpos;
+} audio_state_t;
+
+static void audio_save(void *buf) {
+  *(audio_state_t *)buf = (audio_state_t) { .wpos = atomic_load(&wpos), .rpos = atomic_load(&rpos) };
+}
+
+// sbuf itself is restored with the io space.
+static void audio_load(const void *buf) {
+  const audio_state_t *st = buf;
+  SDL_LockAudio();
+  atomic_store(&rpos, st->rpos);
+  atomic_store(&wpos, st->wpos);
+  SDL_UnlockAudio();
+}
+
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
@@ -109,4 +177,5 @@ void init_audio() {
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  add_snapshot_handle(sizeof(audio_state_t), audio_save, audio_load);
 }
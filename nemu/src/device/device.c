@@ -16,6 +16,8 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/event.h>
+#include <context.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -24,6 +26,7 @@ void init_map();
 void init_serial();
 void init_timer();
 void init_vga();
+void vga_update_screen();
 void init_i8042();
 void init_audio();
 void init_disk();
@@ -32,16 +35,16 @@ void init_alarm();
 void init_ysyxsoc();
 
 void send_key(uint8_t, bool);
-void vga_update_screen();
 
-void device_update() {
+// Called every CONFIG_DEVICE_QUANTUM guest instructions, so the host
+// clock is sampled at most once per quantum.
+static void device_update() {
   static uint64_t last = 0;
   uint64_t now = get_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
-
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
 #ifndef CONFIG_TARGET_AM
@@ -87,5 +90,9 @@ void init_device() {
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
   IFDEF(CONFIG_HAS_YSYXSOC, init_ysyxsoc());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  add_event_handle(CONFIG_DEVICE_QUANTUM, device_update);
+
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_TIMER_ICOUNT) && !defined(CONFIG_TARGET_SHARE)
+  init_alarm();
+#endif
 }
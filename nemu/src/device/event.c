@@ -0,0 +1,54 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <context.h>
+
+#define events   (NEMU_CTX.events)
+#define nr_event (NEMU_CTX.nr_event)
+
+static void update_next_event() {
+  uint64_t next = UINT64_MAX;
+  int i;
+  for (i = 0; i < nr_event; i ++) {
+    if (events[i].deadline < next) next = events[i].deadline;
+  }
+  g_next_event = next;
+}
+
+void add_event_handle(uint64_t period, event_handler_t h) {
+  assert(nr_event < MAX_EVENT);
+  assert(period > 0);
+  events[nr_event ++] = (event_t) {
+    .deadline = g_nr_guest_inst + period,
+    .period = period,
+    .handler = h,
+  };
+  update_next_event();
+}
+
+void device_run_events() {
+  int i;
+  for (i = 0; i < nr_event; i ++) {
+    event_t *e = &events[i];
+    if (g_nr_guest_inst >= e->deadline) {
+      e->handler();
+      e->deadline += e->period;
+      // `g_nr_guest_inst` may jump forward, e.g. after restoring a snapshot.
+      if (e->deadline <= g_nr_guest_inst) e->deadline = g_nr_guest_inst + e->period;
+    }
+  }
+  update_next_event();
+}
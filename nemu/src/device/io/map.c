@@ -15,14 +15,24 @@
 
 #include <isa.h>
 #include <memory/host.h>
+#include <memory/paddr.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
-
-// 512 MB
-#define IO_SPACE_MAX (512 * 1024 * 1024)
-
-static uint8_t *io_space = NULL;
-static uint8_t *p_space = NULL;
+#include <btrace.h>
+
+#if defined(CONFIG_DTRACE) && defined(CONFIG_TRACE_BINARY)
+#define dtrace_log(...)
+#define dtrace_bin(type, addr, len, data) btrace_emit(type, len, cpu.pc, addr, data)
+#elif defined(CONFIG_DTRACE)
+#define dtrace_log(...) Log(__VA_ARGS__)
+#define dtrace_bin(...)
+#else
+#define dtrace_log(...)
+#define dtrace_bin(...)
+#endif
+
+#define io_space (NEMU_CTX.io_space)
+#define p_space  (NEMU_CTX.p_space)
 
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
@@ -33,6 +43,11 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+uint8_t* io_space_used(size_t *size) {
+  *size = p_space - io_space;
+  return io_space;
+}
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -48,8 +63,7 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
-  io_space = malloc(IO_SPACE_MAX);
-  assert(io_space);
+  io_space = host_mem_alloc(IO_SPACE_MAX);
   p_space = io_space;
 }
 
@@ -59,7 +73,7 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   if (in_difftest_tracesim && !map)
     return 0;
 
-  IFDEF(CONFIG_DTRACE, Log("map_read: device=%s, addr=" FMT_PADDR ", len=%d", map->name, addr, len));
+  dtrace_log("map_read: device=%s, addr=" FMT_PADDR ", len=%d", map->name, addr, len);
 
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
@@ -67,7 +81,8 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
 
-  IFDEF(CONFIG_DTRACE, Log("Got: " FMT_WORD, ret));
+  dtrace_log("Got: " FMT_WORD, ret);
+  dtrace_bin(BTRACE_DEV_READ, addr, len, ret);
 
   return ret;
 }
@@ -76,8 +91,9 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   if (in_difftest_tracesim && !map)
     return;
 
-  IFDEF(CONFIG_DTRACE, Log("map_write: device=%s, addr=" FMT_PADDR
-    ", len=%d, data=" FMT_WORD, map->name, addr, len, data));
+  dtrace_log("map_write: device=%s, addr=" FMT_PADDR
+    ", len=%d, data=" FMT_WORD, map->name, addr, len, data);
+  dtrace_bin(BTRACE_DEV_WRITE, addr, len, data);
 
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
@@ -15,11 +15,10 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <context.h>
 
-#define NR_MAP 16
-
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+#define maps   (NEMU_CTX.mmio_maps)
+#define nr_map (NEMU_CTX.nr_mmio_map)
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
   int mapid = find_mapid_by_addr(maps, nr_map, addr);
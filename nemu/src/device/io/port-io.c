@@ -17,7 +17,6 @@
 
 #define PORT_IO_SPACE_MAX 65535
 
-#define NR_MAP 16
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
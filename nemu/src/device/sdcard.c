@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <snapshot.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -40,7 +45,13 @@ enum {
   SDHBLC
 };
 
-static FILE *fp = NULL;
+#define SECTOR_SHIFT 9
+
+// The image is mapped shared, so SDDATA accesses are plain loads and stores.
+// Writes land in the page cache right away and reach the file even if NEMU
+// is killed, so there is nothing to flush on exit.
+static uint8_t *img = NULL;
+static size_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
@@ -51,10 +62,13 @@ static bool read_ext_csd = false;
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
+static inline size_t data_offset() {
+  return ((size_t)blk_addr << SECTOR_SHIFT) + addr;
+}
+
 static void sdcard_handle_cmd(int cmd) {
   switch (cmd) {
     case MMC_GO_IDLE_STATE: break;
@@ -109,10 +123,13 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else {
+         size_t off = data_offset();
+         // Accesses beyond the image are dropped, as the image can not grow.
+         if (off + 4 <= img_size) {
+           if (!write_cmd) { memcpy(&base[SDDATA], img + off, 4); }
+           else { memcpy(img + off, &base[SDDATA], 4); }
+         }
        }
        addr += 4;
        break;
@@ -122,13 +139,48 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+typedef struct {
+  uint32_t blkcnt;
+  long blk_addr;
+  uint32_t addr;
+  bool write_cmd;
+  bool read_ext_csd;
+} sdcard_state_t;
+
+static void sdcard_save(void *buf) {
+  sdcard_state_t *st = buf;
+  *st = (sdcard_state_t) {
+    .blkcnt = blkcnt, .blk_addr = blk_addr, .addr = addr,
+    .write_cmd = write_cmd, .read_ext_csd = read_ext_csd,
+  };
+}
+
+static void sdcard_load(const void *buf) {
+  const sdcard_state_t *st = buf;
+  blkcnt = st->blkcnt;
+  blk_addr = st->blk_addr;
+  addr = st->addr;
+  write_cmd = st->write_cmd;
+  read_ext_csd = st->read_ext_csd;
+}
+
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    Log("Can not find sdcard image: %s", path);
+  } else {
+    img_size = st.st_size;
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map sdcard image: %s", path);
+  }
+  if (fd >= 0) close(fd);
+
+  add_snapshot_handle(sizeof(sdcard_state_t), sdcard_save, sdcard_load);
 }
@@ -15,14 +15,26 @@
 
 #include <device/map.h>
 #include <device/alarm.h>
+#include <device/event.h>
+#include <context.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+#ifdef CONFIG_TIMER_ICOUNT
+
+static uint64_t icount_time() {
+  // Split the division to avoid overflowing `g_nr_guest_inst * 1000000`.
+  uint64_t sec = g_nr_guest_inst / CONFIG_TIMER_ICOUNT_FREQ;
+  uint64_t rem = g_nr_guest_inst % CONFIG_TIMER_ICOUNT_FREQ;
+  return sec * 1000000 + rem * 1000000 / CONFIG_TIMER_ICOUNT_FREQ;
+}
+#endif
+
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = MUXDEF(CONFIG_TIMER_ICOUNT, icount_time(), get_time());
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
@@ -44,5 +56,12 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_TIMER_ICOUNT
+  _Static_assert(CONFIG_TIMER_ICOUNT_FREQ >= TIMER_HZ, "CONFIG_TIMER_ICOUNT_FREQ must be at least TIMER_HZ");
+  add_event_handle(CONFIG_TIMER_ICOUNT_FREQ / TIMER_HZ, timer_intr);
+#else
+  add_alarm_handle(timer_intr);
+#endif
+#endif
 }
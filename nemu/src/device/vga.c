@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <snapshot.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -28,13 +29,62 @@ static uint32_t screen_size() { return screen_width() * screen_height() * sizeof
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+// Pixels written since the last sync: a span [x0, x1) for every scanline
+// and the range [y0, y1) of scanlines that have one. Writes are tracked in
+// the vmem callback, so a sync only copies what changed.
+typedef struct {
+  uint32_t x0, x1;
+} span_t;
+
+typedef struct {
+  span_t row[SCREEN_H];
+  uint32_t y0, y1;
+} dirty_t;
+
+static dirty_t dirty = {};
+
+static inline bool span_empty(const span_t *s) { return s->x0 >= s->x1; }
+
+static inline bool dirty_empty(const dirty_t *d) { return d->y0 >= d->y1; }
+
+static inline void dirty_add(dirty_t *d, uint32_t y, uint32_t x0, uint32_t x1) {
+  span_t *s = &d->row[y];
+  if (span_empty(s)) { *s = (span_t) { x0, x1 }; }
+  else {
+    if (x0 < s->x0) s->x0 = x0;
+    if (x1 > s->x1) s->x1 = x1;
+  }
+  if (dirty_empty(d)) { d->y0 = y; d->y1 = y + 1; }
+  else {
+    if (y < d->y0) d->y0 = y;
+    if (y >= d->y1) d->y1 = y + 1;
+  }
+}
+
+static inline void dirty_clear(dirty_t *d) {
+  for (uint32_t y = d->y0; y < d->y1; y ++) d->row[y] = (span_t) {};
+  d->y0 = d->y1 = 0;
+}
+
+static void mark_all_dirty() {
+  for (uint32_t y = 0; y < SCREEN_H; y ++) dirty_add(&dirty, y, 0, SCREEN_W);
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
+/* On sync the changed spans are copied once from vmem into `front`, which
+ * vga_update_screen() uploads at most TIMER_HZ times a second, next to the
+ * event loop in device_update(). Both run on the CPU thread, which also
+ * created the window, so `front` needs no lock.
+ */
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
+static uint32_t front[SCREEN_W * SCREEN_H];
+static dirty_t ready = {}; // in front, not yet uploaded
+
 static void init_screen() {
   SDL_Window *window = NULL;
   char title[128];
@@ -48,7 +98,30 @@ static void init_screen() {
 }
 
 static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+  for (uint32_t y = dirty.y0; y < dirty.y1; y ++) {
+    span_t s = dirty.row[y];
+    if (span_empty(&s)) continue;
+    uint32_t off = y * SCREEN_W + s.x0;
+    memcpy(front + off, (uint32_t *)vmem + off, (s.x1 - s.x0) * sizeof(uint32_t));
+    dirty_add(&ready, y, s.x0, s.x1);
+  }
+}
+
+void vga_update_screen() {
+  if (dirty_empty(&ready)) return;
+  // Upload every run of changed scanlines as one rectangle.
+  uint32_t y = ready.y0;
+  while (y < ready.y1) {
+    if (span_empty(&ready.row[y])) { y ++; continue; }
+    uint32_t y0 = y, x0 = ready.row[y].x0, x1 = ready.row[y].x1;
+    for (; y < ready.y1 && !span_empty(&ready.row[y]); y ++) {
+      if (ready.row[y].x0 < x0) x0 = ready.row[y].x0;
+      if (ready.row[y].x1 > x1) x1 = ready.row[y].x1;
+    }
+    SDL_Rect area = { .x = x0, .y = y0, .w = x1 - x0, .h = y - y0 };
+    SDL_UpdateTexture(texture, &area, front + y0 * SCREEN_W + x0, SCREEN_W * sizeof(uint32_t));
+  }
+  dirty_clear(&ready);
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -60,26 +133,52 @@ static inline void update_screen() { io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_
 #endif
 #endif
 
-void vga_update_screen() {
-  // call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
-  if (vgactl_port_base[1]) {
-    update_screen();
-    vgactl_port_base[1] = 0;
+#if !defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_TARGET_AM)
+void vga_update_screen() {}
+#endif
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+#ifdef CONFIG_TARGET_AM
+  // The whole frame is drawn on sync, only whether it changed matters.
+  dirty_add(&dirty, 0, 0, 1);
+#else
+  uint32_t pitch = SCREEN_W * sizeof(uint32_t);
+  uint32_t y = offset / pitch;
+  uint32_t x0 = (offset % pitch) / sizeof(uint32_t);
+  uint32_t x1 = (offset % pitch + len + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  dirty_add(&dirty, y, x0, x1 < SCREEN_W ? x1 : SCREEN_W);
+#endif
+}
+
+// The frame is handed over as soon as the guest writes the sync register.
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != 4 || !vgactl_port_base[1]) return;
+  if (!dirty_empty(&dirty)) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    dirty_clear(&dirty);
   }
+  vgactl_port_base[1] = 0;
 }
 
+static void vga_save(void *buf) {}
+
+// vmem is restored behind our back, so redraw everything on the next sync.
+static void vga_load(const void *buf) { mark_all_dirty(); }
+
 void init_vga() {
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, vgactl_io_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, vgactl_io_handler);
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  mark_all_dirty();
+  add_snapshot_handle(0, vga_save, vga_load);
 }
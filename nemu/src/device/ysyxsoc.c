@@ -15,12 +15,9 @@
 
 #include <device/map.h>
 
-static uint8_t *mrom_base = nullptr;
-static uint8_t *sram_base = nullptr;
-static uint8_t *flash_base = nullptr;
-static uint8_t *psram_base = nullptr;
-static uint8_t *sdram_base = nullptr;
-static uint8_t *uart_base = nullptr;
+#include <context.h>
+
+#define uart_base (NEMU_CTX.ysyxsoc_uart)
 
 #define UART_LSR 5
 // We simulate LSR to avoid CacheSim stuck at `putch`.
@@ -42,11 +39,11 @@ static void uart_io_handler(uint32_t offset, int len, bool is_write) {
 }
 
 void init_ysyxsoc() {
-  mrom_base = new_space(CONFIG_MROM_SIZE);
-  sram_base = new_space(CONFIG_SRAM_SIZE);
-  flash_base = new_space(CONFIG_FLASH_SIZE);
-  psram_base = new_space(CONFIG_PSRAM_SIZE);
-  sdram_base = new_space(CONFIG_SDRAM_SIZE);
+  uint8_t *mrom_base = new_space(CONFIG_MROM_SIZE);
+  uint8_t *sram_base = new_space(CONFIG_SRAM_SIZE);
+  uint8_t *flash_base = new_space(CONFIG_FLASH_SIZE);
+  uint8_t *psram_base = new_space(CONFIG_PSRAM_SIZE);
+  uint8_t *sdram_base = new_space(CONFIG_SDRAM_SIZE);
   uart_base = new_space(CONFIG_UART_SIZE);
 
   // Don't use a handler to assert !write, because we need to init difftest.
@@ -31,16 +31,19 @@ void isa_csr_display() {
   }
 }
 
-word_t isa_csr_str2val(const char *s, bool *success) {
+word_t *isa_csr_str2ptr(const char *s) {
   for (int i = 0; i < 4096; i++) {
     if (csr_names[i] == NULL)
       continue;
 
-    if (strcmp(s, csr_names[i]) == 0) {
-      *success = true;
-      return cpu_csr(i);
-    }
+    if (strcmp(s, csr_names[i]) == 0)
+      return &cpu_csr(i);
   }
-  *success = false;
-  return 0;
+  return NULL;
+}
+
+word_t isa_csr_str2val(const char *s, bool *success) {
+  word_t *p = isa_csr_str2ptr(s);
+  *success = p != NULL;
+  return p ? *p : 0;
 }
@@ -363,8 +363,11 @@ int isa_decode_branch(word_t pc, word_t inst, word_t *target_addr, bool *is_unco
   return failed_to_decode;
 }
 
-#ifdef CONFIG_FTRACE
+#ifdef CONFIG_CALL_TRACK
 const char *ftrace_search(uint32_t pc, uint32_t *entry_addr);
+void ftrace_call(uint32_t entry, bool is_tail, uint64_t icount);
+void ftrace_ret(uint32_t pc, uint64_t icount);
+int ftrace_depth();
 
 static int ftrace_dump(Decode *s, int rd, int rs1, word_t imm, char *buf, size_t buf_size) {
   // call:
@@ -391,7 +394,7 @@ static int ftrace_dump(Decode *s, int rd, int rs1, word_t imm, char *buf, size_t
     uint32_t entry_addr;
     const char *callee = ftrace_search(s->dnpc, &entry_addr);
     if (callee == nullptr) {
-      Log("ftrace: Unknown jump at " FMT_WORD, s->dnpc);
+      IFDEF(CONFIG_FTRACE, Log("ftrace: Unknown jump at " FMT_WORD, s->dnpc));
       return -1;
     }
 
@@ -399,14 +402,18 @@ static int ftrace_dump(Decode *s, int rd, int rs1, word_t imm, char *buf, size_t
     if (s->dnpc != entry_addr)
       return -1;
 
-    snprintf(buf, buf_size, FMT_WORD ": %s [%s@" FMT_WORD "]", s->pc, (rd == 1 ? "call" : "tail"), callee, entry_addr);
+    if (buf != NULL)
+      snprintf(buf, buf_size, FMT_WORD ": %*s%s [%s@" FMT_WORD "]", s->pc, ftrace_depth() * 2, "",
+          (rd == 1 ? "call" : "tail"), callee, entry_addr);
+    ftrace_call(entry_addr, rd != 1, g_nr_guest_inst);
   } else if (is_ret) {
     const char *callee = ftrace_search(s->pc, nullptr);
     if (callee == nullptr) {
-      Log("ftrace: Unknown function at " FMT_WORD, s->pc);
+      IFDEF(CONFIG_FTRACE, Log("ftrace: Unknown function at " FMT_WORD, s->pc));
       return -1;
     }
-    snprintf(buf, buf_size, FMT_WORD ": ret [%s]", s->pc, callee);
+    ftrace_ret(s->pc, g_nr_guest_inst);
+    if (buf != NULL) snprintf(buf, buf_size, FMT_WORD ": %*sret [%s]", s->pc, ftrace_depth() * 2, "", callee);
   } else {
     panic("Unreachable");
   }
@@ -26,30 +26,28 @@ void isa_reg_display() {
     printf("x%-2d %-5s  0x%08x  %11d\n", i, regs[i], gpr(i), gpr(i));
 }
 
-word_t isa_reg_str2val(const char *s, bool *success) {
-  if (strcmp(s, "pc") == 0) {
-    *success = true;
-    return cpu.pc;
-  }
+// Returns where the register lives, so that compiled expressions can read it directly.
+word_t *isa_reg_str2ptr(const char *s) {
+  if (strcmp(s, "pc") == 0)
+    return &cpu.pc;
 
   if (s[0] == 'x' || s[0] == 'X') {
     char *endptr;
     word_t idx = strtol(s + 1, &endptr, 10);
-    if (endptr == s + 1 || idx >= 32) {
-      *success = false;
-      return 0;
-    }
-
-    *success = true;
-    return gpr(idx);
+    if (endptr == s + 1 || idx >= 32)
+      return NULL;
+    return &gpr(idx);
   }
 
   for (int i = 0; i < 32; i++) {
-    if (strcmp(s, regs[i]) == 0) {
-      *success = true;
-      return gpr(i);
-    }
+    if (strcmp(s, regs[i]) == 0)
+      return &gpr(i);
   }
-  *success = false;
-  return 0;
+  return NULL;
+}
+
+word_t isa_reg_str2val(const char *s, bool *success) {
+  word_t *p = isa_reg_str2ptr(s);
+  *success = p != NULL;
+  return p ? *p : 0;
 }
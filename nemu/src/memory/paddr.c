@@ -17,11 +17,57 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <btrace.h>
+
+#if defined(CONFIG_MTRACE) && defined(CONFIG_TRACE_BINARY)
+#define mtrace_log(...)
+#define mtrace_bin(type, addr, len, data) btrace_emit(type, len, cpu.pc, addr, data)
+#elif defined(CONFIG_MTRACE)
+#define mtrace_log(...) Log(__VA_ARGS__)
+#define mtrace_bin(...)
+#else
+#define mtrace_log(...)
+#define mtrace_bin(...)
+#endif
+
+#if defined(CONFIG_WATCHPOINT) && !defined(CONFIG_TARGET_AM)
+extern paddr_t wp_mem_lo, wp_mem_hi;
+void wp_mem_check(paddr_t addr, int len, word_t data);
+#define wp_mem_hook(addr, len, data) \
+  do { if (unlikely((addr) + (len) > wp_mem_lo && (addr) < wp_mem_hi)) wp_mem_check(addr, len, data); } while (0)
+#else
+#define wp_mem_hook(addr, len, data)
+#endif
+
+#define pmem (NEMU_CTX.pmem)
 
-#if   defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
-#else // CONFIG_PMEM_GARRAY
-static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
+#ifdef CONFIG_PMEM_GARRAY
+// Backs the machine of difftest_init(). nemu_create() allocates its own.
+static uint8_t pmem_garray[CONFIG_MSIZE] PG_ALIGN = {};
+#endif
+
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+
+uint8_t* host_mem_alloc(size_t size) {
+  // MAP_NORESERVE: nothing is committed until the guest touches it.
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map %zu bytes of host memory", size);
+  IFDEF(CONFIG_MEM_THP, madvise(p, size, MADV_HUGEPAGE));
+  return p;
+}
+
+void host_mem_free(uint8_t *p, size_t size) {
+  if (p != NULL) munmap(p, size);
+}
+#else
+uint8_t* host_mem_alloc(size_t size) {
+  uint8_t *p = malloc(size);
+  assert(p);
+  return p;
+}
+
+void host_mem_free(uint8_t *p, size_t size) { free(p); }
 #endif
 
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
@@ -42,27 +88,30 @@ static void out_of_bound(paddr_t addr) {
 }
 
 void init_mem() {
-#if   defined(CONFIG_PMEM_MALLOC)
-  pmem = malloc(CONFIG_MSIZE);
-  assert(pmem);
+  if (pmem == NULL) {
+    pmem = MUXDEF(CONFIG_PMEM_GARRAY, pmem_garray, host_mem_alloc(CONFIG_MSIZE));
+#if defined(CONFIG_PMEM_GARRAY) && defined(CONFIG_MEM_THP)
+    madvise(pmem, CONFIG_MSIZE, MADV_HUGEPAGE);
 #endif
+  }
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
 word_t paddr_read(paddr_t addr, int len) {
-  IFDEF(CONFIG_MTRACE, Log("paddr_read: Reading from addr: " FMT_PADDR " len: %d", addr, len));
+  mtrace_log("paddr_read: Reading from addr: " FMT_PADDR " len: %d", addr, len);
 
   word_t ret = 0;
   if (likely(in_pmem(addr))) {
     ret = pmem_read(addr, len);
-    IFDEF(CONFIG_MTRACE, Log("paddr_read: in_pmem -> got: " FMT_WORD, ret));
+    mtrace_log("paddr_read: in_pmem -> got: " FMT_WORD, ret);
+    mtrace_bin(BTRACE_MEM_READ, addr, len, ret);
     return ret;
   }
 
 #ifdef CONFIG_DEVICE
   ret = mmio_read(addr, len);
-  IFDEF(CONFIG_MTRACE, Log("paddr_read: mmio_read -> got: " FMT_WORD, ret));
+  mtrace_log("paddr_read: mmio_read -> got: " FMT_WORD, ret);
   return ret;
 #endif
 
@@ -71,17 +120,19 @@ word_t paddr_read(paddr_t addr, int len) {
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  IFDEF(CONFIG_MTRACE, Log("paddr_write: Writing to addr: " FMT_PADDR " len: %d data: " FMT_WORD, addr, len, data));
+  mtrace_log("paddr_write: Writing to addr: " FMT_PADDR " len: %d data: " FMT_WORD, addr, len, data);
+  wp_mem_hook(addr, len, data);
 
   if (likely(in_pmem(addr))) {
     pmem_write(addr, len, data);
-    IFDEF(CONFIG_MTRACE, Log("paddr_write: -> in_pmem"));
+    mtrace_log("paddr_write: -> in_pmem");
+    mtrace_bin(BTRACE_MEM_WRITE, addr, len, data);
     return;
   }
 
 #ifdef CONFIG_DEVICE
-  mmio_write(addr, len, data)
-  IFDEF(CONFIG_MTRACE, Log("paddr_write: -> mmio_write"));
+  mmio_write(addr, len, data);
+  mtrace_log("paddr_write: -> mmio_write");
   return;
 #endif
 
@@ -15,6 +15,11 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <snapshot.h>
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
 
 void init_rand();
 void init_log(const char *log_file);
@@ -44,11 +49,13 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_save_at(uint64_t n, const char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static char *elf_file = NULL;
+static char *snapshot_file = NULL;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -65,8 +72,18 @@ static long load_img() {
 
   Log("The image is %s, size = %ld", img_file, size);
 
+  // Map the image copy-on-write instead of reading it, so only the pages the
+  // guest touches are ever loaded. Falls back to fread() if that is not possible.
+  uint8_t *dest = guest_to_host(RESET_VECTOR);
+  size_t map_size = ROUNDUP(size, PAGE_SIZE);
+  if (size > 0 && ((uintptr_t)dest & PAGE_MASK) == 0 && RESET_VECTOR + map_size - 1 <= PMEM_RIGHT &&
+      mmap(dest, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(fp), 0) != MAP_FAILED) {
+    fclose(fp);
+    return size;
+  }
+
   fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
+  int ret = fread(dest, size, 1, fp);
   assert(ret == 1);
 
   fclose(fp);
@@ -81,10 +98,12 @@ static int parse_args(int argc, char *argv[]) {
       {"port", required_argument, NULL, 'p'},
       {"help", no_argument, NULL, 'h'},
       {"elf", required_argument, NULL, 'e'},
+      {"restore", required_argument, NULL, 'r'},
+      {"save-at", required_argument, NULL, 's'},
       {0, 0, NULL, 0},
   };
   int o;
-  while ((o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
+  while ((o = getopt_long(argc, argv, "-bhl:d:p:e:r:s:", table, NULL)) != -1) {
     switch (o) {
     case 'b':
       sdb_set_batch_mode();
@@ -101,6 +120,19 @@ static int parse_args(int argc, char *argv[]) {
     case 'e':
       elf_file = optarg;
       break;
+    case 'r':
+      snapshot_file = optarg;
+      break;
+    case 's': {
+      uint64_t n;
+      int pos = 0;
+      if (sscanf(optarg, "%" SCNu64 ":%n", &n, &pos) != 1 || pos == 0 || optarg[pos] == '\0') {
+        printf("Expected --save-at=N:FILE, got '%s'\n", optarg);
+        exit(1);
+      }
+      sdb_set_save_at(n, optarg + pos);
+      break;
+    }
     case 1:
       img_file = optarg;
       return 0;
@@ -111,6 +143,8 @@ static int parse_args(int argc, char *argv[]) {
       printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
       printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
       printf("\t-e,--elf=ELF_FILE       load symbols for ftrace.\n");
+      printf("\t-r,--restore=FILE       restore the machine from snapshot FILE\n");
+      printf("\t-s,--save-at=N:FILE     save a snapshot to FILE after N instructions\n");
       printf("\n");
       exit(0);
     }
@@ -142,6 +176,12 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Restore from a snapshot. Let the REF copy the whole memory instead of the image. */
+  if (snapshot_file != NULL) {
+    Assert(snapshot_load(snapshot_file), "Can not restore from '%s'", snapshot_file);
+    img_size = PMEM_RIGHT - RESET_VECTOR + 1;
+  }
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
@@ -149,7 +189,7 @@ void init_monitor(int argc, char *argv[]) {
   init_sdb();
 
   /* Initialize the function trace */
-  IFDEF(CONFIG_FTRACE, init_ftrace(elf_file));
+  IFDEF(CONFIG_CALL_TRACK, init_ftrace(elf_file));
 
   IFDEF(CONFIG_ITRACE, init_disasm());
 
@@ -15,6 +15,8 @@
 
 #include <isa.h>
 
+#include "sdb.h"
+
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
  */
@@ -136,7 +138,7 @@ typedef struct token {
   char *str;
 } Token;
 
-static Token *tokens __attribute__((used)) = {};
+static Token *tokens __attribute__((used)) = NULL;
 static int nr_token __attribute__((used)) = 0;
 static size_t token_buf_size = 128;
 
@@ -322,7 +324,8 @@ int find_dominant_operator(int p, int q, bool *success) {
 
     if (is_binary_token(t) || is_unary_token(t)) {
       int prec = get_precedence(t);
-      if (prec <= min_prec) {
+      // Binary operators are left-associative, unary ones right-associative.
+      if (prec < min_prec || (prec == min_prec && !is_unary_token(t))) {
         min_prec = prec;
         idx = i;
       }
@@ -338,14 +341,44 @@ int find_dominant_operator(int p, int q, bool *success) {
   return idx;
 }
 
-static word_t eval(int p, int q, bool *success) {
-  if (!success)
-    return 0;
+/* Expressions are compiled into postfix code once, so that watchpoints
+ * don't go through the tokenizer and the parser after every instruction.
+ */
+typedef struct {
+  int type; // TK_NUM, TK_REG or an operator
+  union {
+    word_t imm;
+    const word_t *reg;
+  };
+} ExprOp;
+
+struct Expr {
+  ExprOp *code;
+  int len;
+  int cap;
+  int depth;     // stack depth after the last op
+  int max_depth; // stack size needed by expr_eval
+};
 
-  if (p > q) {
-    *success = false;
-    return 0;
+static void emit(Expr *ex, ExprOp op) {
+  if (ex->len == ex->cap) {
+    ex->cap = ex->cap ? ex->cap * 2 : 16;
+    ex->code = realloc(ex->code, ex->cap * sizeof(ExprOp));
+    Assert(ex->code != NULL, "realloc failed, new size: %d", ex->cap);
   }
+  ex->code[ex->len++] = op;
+
+  if (op.type == TK_NUM || op.type == TK_REG)
+    ex->depth++;
+  else if (is_binary_token(op.type))
+    ex->depth--;
+  if (ex->depth > ex->max_depth)
+    ex->max_depth = ex->depth;
+}
+
+static bool compile(Expr *ex, int p, int q) {
+  if (p > q)
+    return false;
 
   if (p == q) {
     if (tokens[p].type == TK_NUM) {
@@ -354,29 +387,27 @@ static word_t eval(int p, int q, bool *success) {
       char *endptr;
       word_t ret = strtol(tokens[p].str, &endptr, base16 ? 16 : 10);
       if (tokens[p].str == endptr) {
-        Log("eval: Bad number: %s", tokens[p].str);
-        *success = false;
-        return 0;
+        Log("compile: Bad number: %s", tokens[p].str);
+        return false;
       }
-      return ret;
+      emit(ex, (ExprOp){.type = TK_NUM, .imm = ret});
+      return true;
     }
 
     if (tokens[p].type == TK_REG) {
-      word_t res = isa_reg_str2val(tokens[p].str + 1, success);
-      if (*success)
-        return res;
-
-      res = isa_csr_str2val(tokens[p].str + 1, success);
-
-      if (!*success)
-        Log("eval: Bad reg/csr: %s", tokens[p].str);
-
-      return res;
+      const word_t *reg = isa_reg_str2ptr(tokens[p].str + 1);
+      if (reg == NULL)
+        reg = isa_csr_str2ptr(tokens[p].str + 1);
+      if (reg == NULL) {
+        Log("compile: Bad reg/csr: %s", tokens[p].str);
+        return false;
+      }
+      emit(ex, (ExprOp){.type = TK_REG, .reg = reg});
+      return true;
     }
 
-    *success = false;
-    Log("eval: unexpected token.");
-    return 0;
+    Log("compile: unexpected token.");
+    return false;
   }
 
   bool invalid_expr = false;
@@ -384,146 +415,156 @@ static word_t eval(int p, int q, bool *success) {
     /* The expression is surrounded by a matched pair of parentheses.
      * If that is the case, just throw away the parentheses.
      */
-    return eval(p + 1, q - 1, success);
+    return compile(ex, p + 1, q - 1);
   }
 
   if (invalid_expr) {
-    *success = false;
-    Log("eval: parentheses mismatch.");
-    return 0;
+    Log("compile: parentheses mismatch.");
+    return false;
   }
 
-  int op = find_dominant_operator(p, q, success);
-  if (!*success)
-    return 0;
+  bool success = true;
+  int op = find_dominant_operator(p, q, &success);
+  if (!success)
+    return false;
 
   if (is_unary_token(tokens[op].type)) {
-    word_t val = eval(op + 1, q, success);
-    if (!*success)
-      return 0;
-    switch (tokens[op].type) {
-    case TK_UNARY_NOT:
-      return ~val;
-    case TK_UNARY_LNOT:
-      return (word_t)(!val);
-    case TK_UNARY_MINUS:
-      return (word_t)(-(int64_t)val);
-    case TK_UNARY_DEREF: {
-      return vaddr_read(val, 4);
-    }
-    default:
-      panic("unexpected unary operator");
-    }
+    if (!compile(ex, op + 1, q))
+      return false;
+    emit(ex, (ExprOp){.type = tokens[op].type});
+    return true;
   }
 
   Assert(is_binary_token(tokens[op].type), "Bad find_dominant_operator");
 
-  word_t val1 = eval(p, op - 1, success);
-
-  if (!*success)
-    return 0;
-
-  word_t val2 = eval(op + 1, q, success);
-
-  if (!*success)
-    return 0;
+  if (!compile(ex, p, op - 1) || !compile(ex, op + 1, q))
+    return false;
+  emit(ex, (ExprOp){.type = tokens[op].type});
+  return true;
+}
 
-  switch (tokens[op].type) {
-#define MAKE_OP(TOK, OP)                                                       \
-  case TOK:                                                                    \
-    return val1 OP val2;
-    MAKE_OP(TK_EQ, ==)
-    MAKE_OP(TK_NE, !=)
-    MAKE_OP(TK_LE, <=)
-    MAKE_OP(TK_LT, <)
-    MAKE_OP(TK_GE, >=)
-    MAKE_OP(TK_GT, >)
-    MAKE_OP(TK_ADD, +)
-    MAKE_OP(TK_SUB, -)
-    MAKE_OP(TK_MUL, *)
-    MAKE_OP(TK_AND, &)
-    MAKE_OP(TK_OR, |)
-    MAKE_OP(TK_XOR, ^)
-    MAKE_OP(TK_SHL, <<)
-    MAKE_OP(TK_LSHR, >>)
-    MAKE_OP(TK_LAND, &&)
-    MAKE_OP(TK_LOR, ||)
-#undef MAKE_OP
-  case TK_ASHR:
-    return (word_t)((sword_t)val1 >> val2);
-  case TK_DIV:
-    if (val2 == 0) {
-      *success = false;
-      return 0;
-    }
-    return val1 / val2;
-  case TK_REM:
-    if (val2 == 0) {
-      *success = false;
-      return 0;
-    }
-    return val1 % val2;
-  default:
-    panic("unexpected binary operator");
-  }
-  return 0;
+void expr_free(Expr *ex) {
+  if (ex == NULL)
+    return;
+  free(ex->code);
+  free(ex);
 }
 
-word_t expr(char *e, bool *success) {
-  Assert(e != NULL && success != NULL, "Bad arguments.");
+Expr *expr_compile(char *e) {
+  Assert(e != NULL, "Bad arguments.");
 
   if (!make_token(e)) {
-    *success = false;
     free_token();
-    return 0;
+    return NULL;
   }
 
   match_unary_tokens();
 
-  *success = true;
-
-  word_t res = eval(0, nr_token - 1, success);
+  Expr *ex = calloc(1, sizeof(Expr));
+  bool ok = compile(ex, 0, nr_token - 1);
   free_token();
 
-  return res;
+  if (!ok) {
+    expr_free(ex);
+    return NULL;
+  }
+  return ex;
 }
 
-bool syntax_check_impl(int p, int q) {
-  if (p > q)
-    return false;
-
-  if (p == q)
-    return true;
-
-  bool invalid_expr = false;
-  if (check_parentheses(p, q, &invalid_expr))
-    return syntax_check_impl(p + 1, q - 1);
-
-  if (invalid_expr)
-    return false;
+word_t expr_eval(const Expr *ex, bool *success) {
+  word_t stack[ex->max_depth];
+  int sp = 0;
 
-  bool success = true;
-  int op = find_dominant_operator(p, q, &success);
-  if (!success)
-    return false;
+  for (const ExprOp *op = ex->code; op != ex->code + ex->len; op++) {
+    switch (op->type) {
+    case TK_NUM:
+      stack[sp++] = op->imm;
+      continue;
+    case TK_REG:
+      stack[sp++] = *op->reg;
+      continue;
+    case TK_UNARY_NOT:
+      stack[sp - 1] = ~stack[sp - 1];
+      continue;
+    case TK_UNARY_LNOT:
+      stack[sp - 1] = !stack[sp - 1];
+      continue;
+    case TK_UNARY_MINUS:
+      stack[sp - 1] = (word_t)(-(int64_t)stack[sp - 1]);
+      continue;
+    case TK_UNARY_DEREF:
+      stack[sp - 1] = vaddr_read(stack[sp - 1], 4);
+      continue;
+    default:
+      break;
+    }
 
-  if (is_unary_token(tokens[op].type))
-    return syntax_check_impl(op + 1, q);
+    word_t val2 = stack[--sp];
+    word_t val1 = stack[sp - 1];
+    word_t res;
+    switch (op->type) {
+#define MAKE_OP(TOK, OP)                                                       \
+  case TOK:                                                                    \
+    res = val1 OP val2;                                                        \
+    break;
+      MAKE_OP(TK_EQ, ==)
+      MAKE_OP(TK_NE, !=)
+      MAKE_OP(TK_LE, <=)
+      MAKE_OP(TK_LT, <)
+      MAKE_OP(TK_GE, >=)
+      MAKE_OP(TK_GT, >)
+      MAKE_OP(TK_ADD, +)
+      MAKE_OP(TK_SUB, -)
+      MAKE_OP(TK_MUL, *)
+      MAKE_OP(TK_AND, &)
+      MAKE_OP(TK_OR, |)
+      MAKE_OP(TK_XOR, ^)
+      MAKE_OP(TK_SHL, <<)
+      MAKE_OP(TK_LSHR, >>)
+      MAKE_OP(TK_LAND, &&)
+      MAKE_OP(TK_LOR, ||)
+#undef MAKE_OP
+    case TK_ASHR:
+      res = (word_t)((sword_t)val1 >> val2);
+      break;
+    case TK_DIV:
+    case TK_REM:
+      if (val2 == 0) {
+        *success = false;
+        return 0;
+      }
+      res = op->type == TK_DIV ? val1 / val2 : val1 % val2;
+      break;
+    default:
+      panic("unexpected operator");
+    }
+    stack[sp - 1] = res;
+  }
 
-  return syntax_check_impl(p, op - 1) && syntax_check_impl(op + 1, q);
+  *success = true;
+  return stack[0];
 }
 
-bool syntax_check(char* e) {
-  Assert(e != NULL, "Bad arguments.");
+word_t expr(char *e, bool *success) {
+  Assert(e != NULL && success != NULL, "Bad arguments.");
 
-  if (!make_token(e)) {
-    free_token();
-    return false;
+  Expr *ex = expr_compile(e);
+  if (ex == NULL) {
+    *success = false;
+    return 0;
   }
 
-  match_unary_tokens();
-  bool res = syntax_check_impl(0, nr_token - 1);
-  free_token();
+  word_t res = expr_eval(ex, success);
+  expr_free(ex);
 
   return res;
 }
+
+bool syntax_check(char *e) {
+  Expr *ex = expr_compile(e);
+  if (ex == NULL)
+    return false;
+  expr_free(ex);
+  return true;
+}
+
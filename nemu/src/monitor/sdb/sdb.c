@@ -19,10 +19,13 @@
 
 #include <cpu/cpu.h>
 #include <isa.h>
+#include <snapshot.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 
 static int is_batch_mode = false;
+static uint64_t save_at = 0;
+static const char *save_at_file = NULL;
 
 void init_regex();
 void init_wp_pool();
@@ -159,6 +162,37 @@ static int cmd_w(char *args) {
   return 0;
 }
 
+void wp_create_mem(paddr_t addr, word_t len);
+// wm ADDR [LEN]
+static int cmd_wm(char *args) {
+  if (args == NULL) {
+    printf("wm: Expected an address.\n");
+    return 0;
+  }
+
+  char *endptr;
+  paddr_t addr = strtoul(args, &endptr, 16);
+  if (endptr == args) {
+    printf("wm: Expected a hexadecimal address.\n");
+    return 0;
+  }
+  char *len_str = endptr;
+  word_t len = strtoul(len_str, &endptr, 0);
+  if (endptr == len_str)
+    len = 4;
+  if (len == 0) {
+    printf("wm: Bad length.\n");
+    return 0;
+  }
+  if ((uint64_t)addr + len > (paddr_t)-1) {
+    printf("wm: [" FMT_PADDR ", +0x%x) wraps around the address space.\n", addr, len);
+    return 0;
+  }
+
+  wp_create_mem(addr, len);
+  return 0;
+}
+
 void wp_delete(int n);
 void bp_delete(int n);
 // d [N]
@@ -212,6 +246,27 @@ static int cmd_b(char *args) {
   return 0;
 }
 
+// save FILE
+static int cmd_save(char *args) {
+  if (args == NULL) {
+    printf("save: Expected a file name.\n");
+    return 0;
+  }
+  snapshot_save(args);
+  return 0;
+}
+
+// load FILE
+static int cmd_load(char *args) {
+  if (args == NULL) {
+    printf("load: Expected a file name.\n");
+    return 0;
+  }
+  if (snapshot_load(args) && nemu_state.state != NEMU_RUNNING)
+    nemu_state.state = NEMU_STOP;
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -229,8 +284,11 @@ static struct {
                  {"x", "Display N consecutive 4-byte words in hexadecimal at given address.", cmd_x},
                  {"p", "Evaluate the expression.", cmd_p},
                  {"w", "Pause execution when the value of the expression changes.", cmd_w},
+                 {"wm", "Pause execution when memory [ADDR, ADDR + LEN) is written. LEN defaults to 4.", cmd_wm},
                  {"b", "Set a breakpoint at the given address/function.", cmd_b},
                  {"d", "Delete the watchpoint/breakpoint with index N.", cmd_d},
+                 {"save", "Save a snapshot of the whole machine to FILE.", cmd_save},
+                 {"load", "Restore the whole machine from the snapshot FILE.", cmd_load},
                     {"l", ""}};
 
 #define NR_CMD ARRLEN(cmd_table)
@@ -259,7 +317,24 @@ static int cmd_help(char *args) {
 
 void sdb_set_batch_mode() { is_batch_mode = true; }
 
+void sdb_set_save_at(uint64_t n, const char *file) {
+  save_at = n;
+  save_at_file = file;
+}
+
 void sdb_mainloop() {
+  if (save_at_file != NULL) {
+    if (save_at > g_nr_guest_inst) cpu_exec(save_at - g_nr_guest_inst);
+    // cpu_exec() also stops early at a watchpoint or when the program ends.
+    bool ended = nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT || nemu_state.state == NEMU_QUIT;
+    if (g_nr_guest_inst != save_at || ended) {
+      Log("snapshot: stopped at %" PRIu64 " instructions instead of --save-at=%" PRIu64 ", '%s' is not written",
+          g_nr_guest_inst, save_at, save_at_file);
+    } else {
+      snapshot_save(save_at_file);
+    }
+  }
+
   if (is_batch_mode) {
     cmd_c(NULL);
     return;
@@ -20,6 +20,11 @@
 
 word_t expr(char *e, bool *success);
 
+typedef struct Expr Expr;
+Expr *expr_compile(char *e);
+word_t expr_eval(const Expr *ex, bool *success);
+void expr_free(Expr *ex);
+
 bool syntax_check(char* e);
 
 #define NR_WP 32
@@ -14,6 +14,7 @@
  ***************************************************************************************/
 
 #include "sdb.h"
+#include <isa.h>
 
 typedef struct watchpoint {
   int NO;
@@ -21,13 +22,36 @@ typedef struct watchpoint {
   struct watchpoint *next;
 
   char *expr;
+  Expr *code;
   word_t last_val;
   bool last_val_valid;
+
+  // Memory watchpoints are checked by paddr_write() instead of wp_update().
+  bool is_mem;
+  paddr_t addr;
+  word_t len;
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
 
+// Union of all watched memory ranges, so that paddr_write() can skip
+// wp_mem_check() with one compare. Empty when wp_mem_lo > wp_mem_hi.
+paddr_t wp_mem_lo = (paddr_t)-1, wp_mem_hi = 0;
+
+static void wp_mem_update_range() {
+  wp_mem_lo = (paddr_t)-1;
+  wp_mem_hi = 0;
+  for (WP *p = head; p != NULL; p = p->next) {
+    if (!p->is_mem)
+      continue;
+    if (p->addr < wp_mem_lo)
+      wp_mem_lo = p->addr;
+    if (p->addr + p->len > wp_mem_hi)
+      wp_mem_hi = p->addr + p->len;
+  }
+}
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i++) {
@@ -52,11 +76,16 @@ void free_wp(WP *wp) {
   Assert(wp, "Watchpoint is NULL");
 
   free(wp->expr);
+  wp->expr = NULL;
+  expr_free(wp->code);
+  wp->code = NULL;
 
   if (wp == head) {
     head = head->next;
     wp->next = free_;
     free_ = wp;
+    if (wp->is_mem)
+      wp_mem_update_range();
     return;
   }
 
@@ -65,6 +94,8 @@ void free_wp(WP *wp) {
       p->next = wp->next;
       wp->next = free_;
       free_ = wp;
+      if (wp->is_mem)
+        wp_mem_update_range();
       return;
     }
   }
@@ -75,7 +106,7 @@ void free_wp(WP *wp) {
 void wp_update_one(WP *p) {
   if (!p->last_val_valid) {
     bool success;
-    p->last_val = expr(p->expr, &success);
+    p->last_val = expr_eval(p->code, &success);
     p->last_val_valid = success;
     if (!success)
       Log("Failed to evaluate '%s' for watchpoint %d.", p->expr, p->NO);
@@ -83,7 +114,7 @@ void wp_update_one(WP *p) {
   }
 
   bool success;
-  word_t curr_val = expr(p->expr, &success);
+  word_t curr_val = expr_eval(p->code, &success);
   if (!success) {
     Log("Failed to evaluate '%s' for watchpoint %d.", p->expr, p->NO);
     return;
@@ -102,8 +133,23 @@ void wp_update_one(WP *p) {
 }
 
 void wp_update() {
-  for (WP *p = head; p != NULL; p = p->next)
-    wp_update_one(p);
+  for (WP *p = head; p != NULL; p = p->next) {
+    if (!p->is_mem)
+      wp_update_one(p);
+  }
+}
+
+void wp_mem_check(paddr_t addr, int len, word_t data) {
+  for (WP *p = head; p != NULL; p = p->next) {
+    if (!p->is_mem || addr + len <= p->addr || addr >= p->addr + p->len)
+      continue;
+    Log("Watchpoint %d: %s written at pc = " FMT_WORD ", addr = " FMT_PADDR ", len = %d, data = " FMT_WORD,
+        p->NO, p->expr, cpu.pc, addr, len, data);
+    p->last_val = data;
+    p->last_val_valid = true;
+    if (nemu_state.state == NEMU_RUNNING)
+      nemu_state.state = NEMU_STOP;
+  }
 }
 
 void wp_display() {
@@ -118,18 +164,21 @@ void wp_display() {
     if (p->last_val_valid)
       printf("%-6d 0x%-13x %s\n", p->NO, p->last_val, p->expr);
     else
-      printf("%-6d %-15s %s\n", p->NO, "Not evaluated", p->expr);
+      printf("%-6d %-15s %s\n", p->NO, p->is_mem ? "Not written" : "Not evaluated", p->expr);
   }
 }
 
 void wp_create(char *expr) {
-  if (!syntax_check(expr)) {
+  Expr *code = expr_compile(expr);
+  if (code == NULL) {
     printf("Bad expression to watch: %s\n", expr);
     return;
   }
 
   WP *p = new_wp();
   p->expr = strdup(expr);
+  p->code = code;
+  p->is_mem = false;
   p->last_val_valid = false;
   p->last_val = 0;
   printf("Watchpoint %d: %s\n", p->NO, p->expr);
@@ -137,3 +186,18 @@ void wp_create(char *expr) {
 }
 
 void wp_delete(int NO) { free_wp(&wp_pool[NO]); }
+
+void wp_create_mem(paddr_t addr, word_t len) {
+  WP *p = new_wp();
+  char buf[64];
+  snprintf(buf, sizeof(buf), "[" FMT_PADDR ", " FMT_PADDR ")", addr, addr + len);
+  p->expr = strdup(buf);
+  p->code = NULL;
+  p->is_mem = true;
+  p->addr = addr;
+  p->len = len;
+  p->last_val_valid = false;
+  p->last_val = 0;
+  wp_mem_update_range();
+  printf("Watchpoint %d: memory %s\n", p->NO, p->expr);
+}
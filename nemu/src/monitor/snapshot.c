@@ -0,0 +1,267 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <snapshot.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Snapshot layout:
+ *   snapshot_header_t | CPU_state | device blobs | pmem | io space
+ * pmem and io space start at page-aligned offsets and all-zero pages are
+ * left as holes, so the file is sparse and both regions can be restored
+ * with a private (copy-on-write) mapping of the file.
+ */
+
+#define SNAPSHOT_MAGIC "NEMUSNAP"
+#define SNAPSHOT_VERSION 1
+#define MAX_SNAPSHOT_HANDLER 8
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t cpu_size;
+  uint64_t nr_guest_inst;
+  uint64_t dev_off, dev_size;
+  uint64_t pmem_off, pmem_size;
+  uint64_t io_off, io_size;
+} snapshot_header_t;
+
+typedef struct {
+  size_t size;
+  snapshot_save_t save;
+  snapshot_load_t load;
+} snapshot_handler_t;
+
+
+static snapshot_handler_t handler[MAX_SNAPSHOT_HANDLER] = {};
+static int nr_handler = 0;
+static size_t dev_size = 0;
+
+void add_snapshot_handle(size_t size, snapshot_save_t save, snapshot_load_t load) {
+  assert(nr_handler < MAX_SNAPSHOT_HANDLER);
+  handler[nr_handler ++] = (snapshot_handler_t) { .size = size, .save = save, .load = load };
+  dev_size += size;
+}
+
+static uint64_t page_align(uint64_t off) {
+  return (off + PAGE_MASK) & ~PAGE_MASK;
+}
+
+static size_t page_len(size_t off, size_t size) {
+  return size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+}
+
+static bool is_zero_page(const uint8_t *p, size_t len) {
+  const uint64_t *q = (const uint64_t *)p;
+  size_t i;
+  for (i = 0; i < len / sizeof(uint64_t); i ++) {
+    if (q[i] != 0) return false;
+  }
+  for (i = i * sizeof(uint64_t); i < len; i ++) {
+    if (p[i] != 0) return false;
+  }
+  return true;
+}
+
+static bool pwrite_all(int fd, const void *buf, size_t size, off_t off) {
+  const uint8_t *p = buf;
+  while (size > 0) {
+    ssize_t ret = pwrite(fd, p, size, off);
+    if (ret <= 0) return false;
+    p += ret; off += ret; size -= ret;
+  }
+  return true;
+}
+
+static bool pread_all(int fd, void *buf, size_t size, off_t off) {
+  uint8_t *p = buf;
+  while (size > 0) {
+    ssize_t ret = pread(fd, p, size, off);
+    if (ret < 0) return false;
+    // Holes at the end of the file
+    if (ret == 0) { memset(p, 0, size); return true; }
+    p += ret; off += ret; size -= ret;
+  }
+  return true;
+}
+
+// Write runs of non-zero pages only, leaving holes for the zero ones.
+static bool write_sparse(int fd, const uint8_t *buf, size_t size, off_t off) {
+  size_t i = 0;
+  while (i < size) {
+    if (is_zero_page(buf + i, page_len(i, size))) { i += page_len(i, size); continue; }
+    size_t start = i;
+    while (i < size && !is_zero_page(buf + i, page_len(i, size))) {
+      i += page_len(i, size);
+    }
+    if (!pwrite_all(fd, buf + start, i - start, off + start)) return false;
+  }
+  return true;
+}
+
+// A region of the file read or mapped at a temporary address, so that the
+// whole snapshot can be checked before any guest state is touched.
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  off_t off;
+  bool mapped;
+} staged_region_t;
+
+static bool stage_region(int fd, staged_region_t *r, size_t size, off_t off) {
+  *r = (staged_region_t) { .size = size, .off = off };
+  if (size == 0) return true;
+  void *ret = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, off);
+  if (ret != MAP_FAILED) { r->buf = ret; r->mapped = true; return true; }
+  r->buf = malloc(size);
+  if (r->buf != NULL && pread_all(fd, r->buf, size, off)) return true;
+  free(r->buf);
+  r->buf = NULL;
+  return false;
+}
+
+static void drop_region(staged_region_t *r) {
+  if (r->buf == NULL) return;
+  if (r->mapped) munmap(r->buf, r->size);
+  else free(r->buf);
+  r->buf = NULL;
+}
+
+// Cannot fail: if the copy-on-write mapping is refused, copy the staged data.
+static void commit_region(int fd, staged_region_t *r, uint8_t *dst) {
+  if (r->size == 0) return;
+  if (r->mapped && ((uintptr_t)dst & PAGE_MASK) == 0 && (r->size & PAGE_MASK) == 0) {
+    void *ret = mmap(dst, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, r->off);
+    if (ret != MAP_FAILED) return;
+  }
+  memcpy(dst, r->buf, r->size);
+}
+
+bool snapshot_save(const char *path) {
+  size_t io_size = 0;
+  uint8_t *io = MUXDEF(CONFIG_DEVICE, io_space_used(&io_size), NULL);
+
+  snapshot_header_t h = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .cpu_size = sizeof(CPU_state),
+    .nr_guest_inst = g_nr_guest_inst,
+    .dev_off = sizeof(h) + sizeof(CPU_state),
+    .dev_size = dev_size,
+    .pmem_size = CONFIG_MSIZE,
+    .io_size = io_size,
+  };
+  h.pmem_off = page_align(h.dev_off + h.dev_size);
+  h.io_off = page_align(h.pmem_off + h.pmem_size);
+
+  // Write to a new inode, so that a process which restored from `path`
+  // never sees its copy-on-write backing file change underneath.
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { Log("snapshot: can not open '%s'", tmp); return false; }
+
+  uint8_t *dev = malloc(dev_size + 1);
+  uint8_t *p = dev;
+  int i;
+  for (i = 0; i < nr_handler; i ++) {
+    handler[i].save(p);
+    p += handler[i].size;
+  }
+
+  bool ok = pwrite_all(fd, &h, sizeof(h), 0) &&
+    pwrite_all(fd, &cpu, sizeof(cpu), sizeof(h)) &&
+    pwrite_all(fd, dev, dev_size, h.dev_off) &&
+    write_sparse(fd, guest_to_host(CONFIG_MBASE), h.pmem_size, h.pmem_off) &&
+    write_sparse(fd, io, h.io_size, h.io_off) &&
+    ftruncate(fd, h.io_off + h.io_size) == 0;
+  free(dev);
+  close(fd);
+
+  if (!ok || rename(tmp, path) != 0) {
+    Log("snapshot: failed to write '%s'", path);
+    unlink(tmp);
+    return false;
+  }
+  Log("snapshot: saved to '%s' at %" PRIu64 " instructions", path, g_nr_guest_inst);
+  return true;
+}
+
+bool snapshot_load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { Log("snapshot: can not open '%s'", path); return false; }
+
+  size_t io_size = 0;
+  uint8_t *io = MUXDEF(CONFIG_DEVICE, io_space_used(&io_size), NULL);
+
+  // The layout is fully determined by the build, so check every offset and
+  // that the file is long enough before reading anything else.
+  snapshot_header_t h;
+  struct stat st;
+  bool ok = pread_all(fd, &h, sizeof(h), 0) &&
+    memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0 &&
+    h.version == SNAPSHOT_VERSION && h.cpu_size == sizeof(CPU_state) &&
+    h.dev_size == dev_size && h.pmem_size == CONFIG_MSIZE && h.io_size == io_size &&
+    h.dev_off == sizeof(h) + sizeof(CPU_state) &&
+    h.pmem_off == page_align(h.dev_off + h.dev_size) &&
+    h.io_off == page_align(h.pmem_off + h.pmem_size);
+  if (!ok) {
+    Log("snapshot: '%s' does not match this build of NEMU", path);
+    close(fd);
+    return false;
+  }
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < h.io_off + h.io_size) {
+    Log("snapshot: '%s' is truncated", path);
+    close(fd);
+    return false;
+  }
+
+  // Stage everything first, so a failure leaves the machine untouched.
+  static CPU_state new_cpu;
+  uint8_t *dev = malloc(dev_size + 1);
+  staged_region_t pmem_r = {}, io_r = {};
+  ok = pread_all(fd, &new_cpu, sizeof(new_cpu), sizeof(h)) &&
+    pread_all(fd, dev, dev_size, h.dev_off) &&
+    stage_region(fd, &pmem_r, h.pmem_size, h.pmem_off) &&
+    stage_region(fd, &io_r, h.io_size, h.io_off);
+
+  if (ok) {
+    commit_region(fd, &pmem_r, guest_to_host(CONFIG_MBASE));
+    commit_region(fd, &io_r, io);
+    cpu = new_cpu;
+    uint8_t *p = dev;
+    int i;
+    for (i = 0; i < nr_handler; i ++) {
+      handler[i].load(p);
+      p += handler[i].size;
+    }
+    g_nr_guest_inst = h.nr_guest_inst;
+    Log("snapshot: restored from '%s' at %" PRIu64 " instructions", path, g_nr_guest_inst);
+  } else {
+    Log("snapshot: failed to read '%s'", path);
+  }
+  drop_region(&pmem_r);
+  drop_region(&io_r);
+  close(fd);
+  free(dev);
+  return ok;
+}
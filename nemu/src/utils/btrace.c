@@ -0,0 +1,105 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <btrace.h>
+#include <context.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* Trace records are pushed into a single-producer ring buffer by the
+ * interpreter and drained by a writer thread, so the hot path never
+ * formats text or touches stdio.
+ */
+
+#define BTRACE_RING_SZ (1 << 16)
+#define BTRACE_RING_MASK (BTRACE_RING_SZ - 1)
+
+bool log_enable();
+
+static btrace_rec_t ring[BTRACE_RING_SZ];
+static _Atomic uint64_t head = 0; // advanced by the writer
+static _Atomic uint64_t tail = 0; // advanced by the interpreter
+static atomic_bool stop = false;
+static FILE *fp = NULL;
+static bool closed = false;
+static pthread_t writer;
+
+static void *btrace_writer(void *arg) {
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  while (true) {
+    uint64_t t = atomic_load_explicit(&tail, memory_order_acquire);
+    if (h == t) {
+      if (atomic_load(&stop)) break;
+      struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000 };
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    // Write up to the end of the ring, the rest goes in the next round.
+    uint64_t n = t - h;
+    uint64_t to_end = BTRACE_RING_SZ - (h & BTRACE_RING_MASK);
+    if (n > to_end) n = to_end;
+    size_t ret = fwrite(&ring[h & BTRACE_RING_MASK], sizeof(btrace_rec_t), n, fp);
+    assert(ret == n);
+    h += n;
+    atomic_store_explicit(&head, h, memory_order_release);
+  }
+  fflush(fp);
+  return NULL;
+}
+
+void btrace_emit(uint8_t type, uint8_t len, vaddr_t pc, paddr_t addr, word_t data) {
+  if (!log_enable() || closed) return;
+
+  uint64_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+  while (t - atomic_load_explicit(&head, memory_order_acquire) == BTRACE_RING_SZ) {
+    sched_yield();
+  }
+  ring[t & BTRACE_RING_MASK] = (btrace_rec_t) {
+    .type = type, .len = len, .pc = pc, .icount = g_nr_guest_inst, .addr = addr, .data = data,
+  };
+  atomic_store_explicit(&tail, t + 1, memory_order_release);
+}
+
+/* Waits for the writer to drain the ring and closes the file. Besides exit, it runs
+ * when NEMU fails through Assert/panic or NEMU_ABORT, since the records right before
+ * the failure are the ones that matter. A plain abort() loses what is still in the
+ * ring: joining a thread and closing a FILE are not safe in a signal handler.
+ */
+void btrace_flush() {
+  if (fp == NULL || closed) return;
+  closed = true;
+  atomic_store(&stop, true);
+  pthread_join(writer, NULL);
+  fclose(fp);
+}
+
+void init_btrace(const char *log_file) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.btrace", log_file ? log_file : "nemu");
+  fp = fopen(path, "wb");
+  Assert(fp, "Can not open '%s'", path);
+
+  btrace_header_t h = { .magic = BTRACE_MAGIC, .version = BTRACE_VERSION, .rec_size = sizeof(btrace_rec_t) };
+  size_t ret = fwrite(&h, sizeof(h), 1, fp);
+  assert(ret == 1);
+
+  ret = pthread_create(&writer, NULL, btrace_writer, NULL);
+  Assert(ret == 0, "Can not create the trace writer thread");
+  atexit(btrace_flush);
+  Log("Binary trace is written to %s", path);
+}
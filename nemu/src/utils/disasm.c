@@ -59,7 +59,20 @@ void init_disasm() {
 #endif
 }
 
-void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+// Capstone results memoized by (pc, code). The cache is direct-mapped,
+// a colliding entry is simply replaced.
+#define DISASM_CACHE_SZ 4096
+#define DISASM_MAX_NBYTE 16
+#define DISASM_STR_SZ 96
+
+static struct {
+  uint64_t pc;
+  uint8_t code[DISASM_MAX_NBYTE];
+  int nbyte;
+  char str[DISASM_STR_SZ];
+} cache[DISASM_CACHE_SZ];
+
+static void disassemble_capstone(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
   cs_insn *insn;
   size_t count = cs_disasm_dl(handle, code, nbyte, pc, 0, &insn);
   assert(count == 1);
@@ -69,3 +82,23 @@ void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
   }
   cs_free_dl(insn, count);
 }
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  if (nbyte > DISASM_MAX_NBYTE) {
+    disassemble_capstone(str, size, pc, code, nbyte);
+    return;
+  }
+
+  uint32_t word = 0;
+  memcpy(&word, code, nbyte < 4 ? nbyte : 4);
+  uint64_t h = (pc >> 1) ^ ((uint64_t)word * 0x9e3779b97f4a7c15ull >> 40);
+  typeof(cache[0]) *e = &cache[h % DISASM_CACHE_SZ];
+
+  if (e->nbyte != nbyte || e->pc != pc || memcmp(e->code, code, nbyte) != 0) {
+    e->pc = pc;
+    e->nbyte = nbyte;
+    memcpy(e->code, code, nbyte);
+    disassemble_capstone(e->str, sizeof(e->str), pc, code, nbyte);
+  }
+  snprintf(str, size, "%s", e->str);
+}
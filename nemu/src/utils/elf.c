@@ -16,17 +16,37 @@
 #include "debug.h"
 
 #include <elf.h>
+#include <limits.h>
 #include <stdio.h>
 
+// Function symbols sorted by address. Names live in an interned string pool
+// and are referenced by offset.
 typedef struct ftrace_sym_t {
   uint32_t addr;
   uint32_t size;
-  char name[128];
+  uint32_t name;
+  int parent; // innermost earlier symbol whose range contains this one, or -1
 } ftrace_sym_t;
 
-#define FTRACE_TABLE_MAXSIZE 8192
-ftrace_sym_t ftrace_table[FTRACE_TABLE_MAXSIZE];
-size_t ftrace_size = 0;
+static ftrace_sym_t *ftrace_table = NULL;
+static size_t ftrace_size = 0;
+static size_t ftrace_cap = 0;
+
+static char *pool = NULL;
+static size_t pool_size = 0;
+static size_t pool_cap = 0;
+
+// Open-addressing map from a name to its pool offset and the address of the
+// first symbol with that name. It interns the names, and it still finds the
+// aliases that ftrace_table_finish() drops for sharing an address.
+typedef struct {
+  uint32_t name; // UINT32_MAX if the slot is empty
+  uint32_t addr;
+} name_ent_t;
+
+static name_ent_t *intern_tab = NULL;
+static size_t intern_cap = 0;
+static size_t intern_size = 0;
 
 static void *read_chunk(FILE *fp, size_t off, size_t sz) {
   void *buf = malloc(sz);
@@ -43,43 +63,345 @@ static void free_chunk(void *buf) {
   free(buf);
 }
 
+static uint32_t hash_str(const char *str) {
+  uint32_t h = 2166136261u;
+  for (; *str; str++) h = (h ^ (uint8_t)*str) * 16777619u;
+  return h;
+}
+
+// The slot of `name`, or the empty slot where it belongs.
+static name_ent_t *intern_slot(const char *name) {
+  size_t i = hash_str(name) & (intern_cap - 1);
+  for (; intern_tab[i].name != UINT32_MAX; i = (i + 1) & (intern_cap - 1)) {
+    if (strcmp(pool + intern_tab[i].name, name) == 0) break;
+  }
+  return &intern_tab[i];
+}
+
+static uint32_t intern(const char *name, uint32_t addr) {
+  if ((intern_size + 1) * 2 > intern_cap) {
+    name_ent_t *old = intern_tab;
+    size_t old_cap = intern_cap;
+    intern_cap = intern_cap ? intern_cap * 2 : 1024;
+    intern_tab = malloc(intern_cap * sizeof(name_ent_t));
+    Assert(intern_tab != NULL, "ftrace: out of memory");
+    memset(intern_tab, 0xff, intern_cap * sizeof(name_ent_t));
+    for (size_t i = 0; i < old_cap; i++) {
+      if (old[i].name != UINT32_MAX) *intern_slot(pool + old[i].name) = old[i];
+    }
+    free(old);
+  }
+
+  name_ent_t *e = intern_slot(name);
+  if (e->name != UINT32_MAX) return e->name;
+
+  size_t len = strlen(name) + 1;
+  if (pool_size + len > pool_cap) {
+    pool_cap = (pool_size + len) * 2;
+    pool = realloc(pool, pool_cap);
+    Assert(pool != NULL, "ftrace: out of memory");
+  }
+  uint32_t off = pool_size;
+  memcpy(pool + off, name, len);
+  pool_size += len;
+  *e = (name_ent_t) { .name = off, .addr = addr };
+  intern_size++;
+  return off;
+}
+
 void ftrace_table_push(uint32_t addr, uint32_t size, const char *name) {
-  Assert(ftrace_size < FTRACE_TABLE_MAXSIZE, "ftrace table is full");
+  Assert(name != nullptr, "name is null");
+  if (ftrace_size == ftrace_cap) {
+    ftrace_cap = ftrace_cap ? ftrace_cap * 2 : 1024;
+    ftrace_table = realloc(ftrace_table, ftrace_cap * sizeof(ftrace_sym_t));
+    Assert(ftrace_table != NULL, "ftrace: out of memory");
+  }
   ftrace_table[ftrace_size].addr = addr;
   ftrace_table[ftrace_size].size = size;
-
-  Assert(name != nullptr, "name is null");
-  Assert(strlen(name) < sizeof(ftrace_table[ftrace_size].name), "name is too long");
-
-  strncpy(ftrace_table[ftrace_size].name, name, sizeof(ftrace_table[ftrace_size].name));
+  ftrace_table[ftrace_size].name = intern(name, addr);
+  ftrace_table[ftrace_size].parent = -1;
   ftrace_size++;
   // Log("ftrace: %s @ 0x%x", name, addr);
 }
 
+static int sym_cmp(const void *a, const void *b) {
+  const ftrace_sym_t *x = a, *y = b;
+  if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+  // Larger first, so that it is kept when dropping duplicates.
+  return x->size > y->size ? -1 : x->size < y->size;
+}
+
+static bool sym_contains(const ftrace_sym_t *sym, uint32_t pc) {
+  return pc >= sym->addr && (uint64_t)pc < (uint64_t)sym->addr + sym->size;
+}
+
+// Sort by address and drop symbols with the same address (e.g. from both
+// SHT_SYMTAB and SHT_DYNSYM, or aliases, which are still found by name).
+// Symbols may still nest (local labels, aliases with a smaller size), so
+// link each one to its enclosing symbol.
+static void ftrace_table_finish() {
+  if (ftrace_size == 0) return;
+  qsort(ftrace_table, ftrace_size, sizeof(ftrace_sym_t), sym_cmp);
+  size_t n = 1;
+  for (size_t i = 1; i < ftrace_size; i++) {
+    if (ftrace_table[i].addr != ftrace_table[n - 1].addr) ftrace_table[n++] = ftrace_table[i];
+  }
+  ftrace_size = n;
+
+  // Walk the parent chain of the previous symbol, which is the stack of
+  // ranges still open at this address.
+  for (size_t i = 0; i < ftrace_size; i++) {
+    int p = (int)i - 1;
+    while (p >= 0 && !sym_contains(&ftrace_table[p], ftrace_table[i].addr)) p = ftrace_table[p].parent;
+    ftrace_table[i].parent = p;
+  }
+}
+
+static int ftrace_index(uint32_t pc) {
+  static size_t last_hit = 0;
+  // The cached symbol is only the answer if no nested symbol starts before pc.
+  if (last_hit < ftrace_size && sym_contains(&ftrace_table[last_hit], pc) &&
+      (last_hit + 1 == ftrace_size || pc < ftrace_table[last_hit + 1].addr))
+    return last_hit;
+
+  // Find the last symbol with addr <= pc
+  size_t l = 0, r = ftrace_size;
+  while (l < r) {
+    size_t mid = (l + r) / 2;
+    if (ftrace_table[mid].addr <= pc) l = mid + 1;
+    else r = mid;
+  }
+  // pc may be past the end of that symbol but still inside an enclosing one.
+  int i = (int)l - 1;
+  while (i >= 0 && !sym_contains(&ftrace_table[i], pc)) i = ftrace_table[i].parent;
+  if (i >= 0) last_hit = i;
+  return i;
+}
+
 const char* ftrace_search(uint32_t pc, uint32_t* entry_addr)
 {
-  for (size_t i = 0; i < ftrace_size; i++)
-  {
-    if (pc >= ftrace_table[i].addr && pc < ftrace_table[i].addr + ftrace_table[i].size)
-    {
-      if (entry_addr)
-        *entry_addr = ftrace_table[i].addr;
-      return ftrace_table[i].name;
-    }
-  }
-  return nullptr;
+  int i = ftrace_index(pc);
+  if (i < 0) return nullptr;
+  if (entry_addr)
+    *entry_addr = ftrace_table[i].addr;
+  return pool + ftrace_table[i].name;
 }
 
 word_t ftrace_get_address_of(const char* name)
 {
-  for (size_t i = 0; i < ftrace_size; i++)
-  {
-    if (strcmp(ftrace_table[i].name, name) == 0)
-      return ftrace_table[i].addr;
+  if (intern_size == 0) return 0;
+  name_ent_t *e = intern_slot(name);
+  return e->name == UINT32_MAX ? 0 : e->addr;
+}
+
+/* Shadow call stack.
+ * Each frame records the instruction count at entry and the instructions
+ * spent in its callees, so inclusive/exclusive counts are accumulated on
+ * return without any per-instruction work.
+ */
+#define FTRACE_STACK_MAXDEPTH 4096
+
+typedef struct {
+  uint64_t calls;
+  uint64_t incl;
+  uint64_t excl;
+  uint64_t pc_self; // from the per-pc profiler, see cpu-exec.c
+  uint32_t active; // frames of this function on the stack, to handle recursion
+} ftrace_prof_t;
+
+static ftrace_prof_t *prof = NULL;
+static uint64_t unknown_pc_self = 0;
+
+// Calling context tree. Node 0 is the root (no function), and each node
+// accumulates the exclusive instructions of one call path.
+typedef struct {
+  int sym;
+  int parent;
+  int child;
+  int sibling;
+  uint64_t self;
+} ftrace_node_t;
+
+static ftrace_node_t *nodes = NULL;
+static int nr_node = 0;
+static int node_cap = 0;
+
+static struct {
+  int sym;
+  int node;
+  uint64_t enter;
+  uint64_t child;
+} stack[FTRACE_STACK_MAXDEPTH];
+static int depth = 0;
+// Instructions spent in top-level frames.
+static uint64_t top_level_incl = 0;
+
+static int cct_child(int parent, int sym) {
+  if (nodes == NULL) {
+    node_cap = 1024;
+    nodes = malloc(node_cap * sizeof(ftrace_node_t));
+    nodes[0] = (ftrace_node_t) { .sym = -1, .parent = -1, .child = -1, .sibling = -1 };
+    nr_node = 1;
   }
-  return 0;
+  int n;
+  for (n = nodes[parent].child; n >= 0; n = nodes[n].sibling) {
+    if (nodes[n].sym == sym) return n;
+  }
+  if (nr_node == node_cap) {
+    node_cap *= 2;
+    nodes = realloc(nodes, node_cap * sizeof(ftrace_node_t));
+    Assert(nodes != NULL, "ftrace: out of memory");
+  }
+  n = nr_node++;
+  nodes[n] = (ftrace_node_t) { .sym = sym, .parent = parent, .child = -1, .sibling = nodes[parent].child };
+  nodes[parent].child = n;
+  return n;
+}
+
+int ftrace_depth() { return depth; }
+
+static void ftrace_pop(uint64_t icount) {
+  depth--;
+  uint64_t incl = icount - stack[depth].enter;
+  ftrace_prof_t *p = &prof[stack[depth].sym];
+  p->excl += incl - stack[depth].child;
+  nodes[stack[depth].node].self += incl - stack[depth].child;
+  if (--p->active == 0) p->incl += incl;
+  if (depth > 0) stack[depth - 1].child += incl;
+  else top_level_incl += incl;
+}
+
+void ftrace_call(uint32_t entry, bool is_tail, uint64_t icount) {
+  int i = ftrace_index(entry);
+  if (i < 0) return;
+  // A tail call replaces the caller's frame.
+  if (is_tail && depth > 0) ftrace_pop(icount);
+  if (depth == FTRACE_STACK_MAXDEPTH) {
+    static bool warned = false;
+    if (!warned) {
+      Log("ftrace: shadow stack is full (%d frames), deeper calls are not profiled", FTRACE_STACK_MAXDEPTH);
+      warned = true;
+    }
+    return;
+  }
+  stack[depth].node = cct_child(depth > 0 ? stack[depth - 1].node : 0, i);
+  stack[depth].sym = i;
+  stack[depth].enter = icount;
+  stack[depth].child = 0;
+  depth++;
+  prof[i].calls++;
+  prof[i].active++;
+}
+
+void ftrace_ret(uint32_t pc, uint64_t icount) {
+  int i = ftrace_index(pc);
+  int d;
+  for (d = depth - 1; d >= 0 && stack[d].sym != i; d--);
+  // Not on the stack, e.g. returning from the function that was running before ftrace started.
+  if (d < 0) return;
+  while (depth > d) ftrace_pop(icount);
+}
+
+static int prof_cmp(const void *a, const void *b) {
+  uint64_t x = prof[*(const int *)a].excl, y = prof[*(const int *)b].excl;
+  return x > y ? -1 : x < y;
 }
 
+static int pc_self_cmp(const void *a, const void *b) {
+  uint64_t x = prof[*(const int *)a].pc_self, y = prof[*(const int *)b].pc_self;
+  return x > y ? -1 : x < y;
+}
+
+#define FTRACE_PROFILE_TOP 20
+
+void ftrace_profile_display(uint64_t icount) {
+  if (prof == NULL || icount == 0) return;
+  while (depth > 0) ftrace_pop(icount);
+
+  int *order = malloc(ftrace_size * sizeof(int));
+  int n = 0;
+  for (size_t i = 0; i < ftrace_size; i++) {
+    if (prof[i].calls > 0) order[n++] = i;
+  }
+  qsort(order, n, sizeof(int), prof_cmp);
+
+  printf("ftrace profile (instructions, top %d by self):\n", FTRACE_PROFILE_TOP);
+  printf("%12s %14s %7s %14s %7s  %s\n", "calls", "self", "self%", "total", "total%", "function");
+  for (int k = 0; k < n && k < FTRACE_PROFILE_TOP; k++) {
+    ftrace_prof_t *p = &prof[order[k]];
+    printf("%12" PRIu64 " %14" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%%  %s\n",
+        p->calls, p->excl, 100.0 * p->excl / icount, p->incl, 100.0 * p->incl / icount,
+        pool + ftrace_table[order[k]].name);
+  }
+  free(order);
+}
+
+// Per-pc counts from the profiler, folded into the function containing pc.
+void ftrace_profile_add_pc(uint32_t pc, uint64_t count) {
+  int i = ftrace_index(pc);
+  if (i < 0) unknown_pc_self += count;
+  else prof[i].pc_self += count;
+}
+
+static void write_stack(FILE *fp, int n) {
+  if (nodes[n].parent > 0) {
+    write_stack(fp, nodes[n].parent);
+    fputc(';', fp);
+  }
+  fputs(pool + ftrace_table[nodes[n].sym].name, fp);
+}
+
+// Write `<prefix>.txt` with per-function self/total counts and
+// `<prefix>.folded` with collapsed stacks for flamegraph.pl/speedscope.
+void ftrace_profile_write(const char *prefix, uint64_t icount) {
+  if (prof == NULL || icount == 0) return;
+  while (depth > 0) ftrace_pop(icount);
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s.txt", prefix);
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    Log("profile: can not open %s", path);
+    return;
+  }
+  int *order = malloc(ftrace_size * sizeof(int));
+  int n = 0;
+  for (size_t i = 0; i < ftrace_size; i++) {
+    if (prof[i].pc_self > 0 || prof[i].calls > 0) order[n++] = i;
+  }
+  qsort(order, n, sizeof(int), pc_self_cmp);
+  fprintf(fp, "# %" PRIu64 " instructions\n", icount);
+  fprintf(fp, "%14s %7s %14s %7s %12s  %s\n", "self", "self%", "total", "total%", "calls", "function");
+  for (int k = 0; k < n; k++) {
+    ftrace_prof_t *p = &prof[order[k]];
+    fprintf(fp, "%14" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%% %12" PRIu64 "  %s\n",
+        p->pc_self, 100.0 * p->pc_self / icount, p->incl, 100.0 * p->incl / icount, p->calls,
+        pool + ftrace_table[order[k]].name);
+  }
+  if (unknown_pc_self > 0) {
+    fprintf(fp, "%14" PRIu64 " %6.2f%% %14s %7s %12s  [unknown]\n",
+        unknown_pc_self, 100.0 * unknown_pc_self / icount, "-", "-", "-");
+  }
+  free(order);
+  fclose(fp);
+  Log("profile: function table written to %s", path);
+
+  snprintf(path, sizeof(path), "%s.folded", prefix);
+  fp = fopen(path, "w");
+  if (fp == NULL) {
+    Log("profile: can not open %s", path);
+    return;
+  }
+  // Instructions outside of any tracked frame, e.g. the startup code before main.
+  if (icount > top_level_incl) fprintf(fp, "[outside] %" PRIu64 "\n", icount - top_level_incl);
+  for (int i = 1; i < nr_node; i++) {
+    if (nodes[i].self == 0) continue;
+    write_stack(fp, i);
+    fprintf(fp, " %" PRIu64 "\n", nodes[i].self);
+  }
+  fclose(fp);
+  Log("profile: collapsed stacks written to %s", path);
+}
 
 void init_ftrace(const char *file) {
   if (file == NULL) {
@@ -145,5 +467,8 @@ void init_ftrace(const char *file) {
   free_chunk(shdrs);
   fclose(fp);
 
+  ftrace_table_finish();
+  prof = calloc(ftrace_size, sizeof(ftrace_prof_t));
+
   Log("ftrace: loaded %zu function symbols", ftrace_size);
-}
\ No newline at end of file
+}
@@ -23,6 +23,11 @@ $(LIBCAPSTONE):
 	$(MAKE) -C tools/capstone
 endif
 
-ifeq ($(CONFIG_FTRACE),)
+ifeq ($(CONFIG_CALL_TRACK),)
 SRCS-BLACKLIST-y += src/utils/elf.c
-endif
\ No newline at end of file
+endif
+ifeq ($(CONFIG_TRACE_BINARY),)
+SRCS-BLACKLIST-y += src/utils/btrace.c
+else
+LIBS += -lpthread
+endif
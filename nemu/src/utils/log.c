@@ -14,8 +14,9 @@
 ***************************************************************************************/
 
 #include <common.h>
+#include <btrace.h>
+#include <context.h>
 
-extern uint64_t g_nr_guest_inst;
 
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
@@ -28,6 +29,7 @@ void init_log(const char *log_file) {
     log_fp = fp;
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
+  IFDEF(CONFIG_TRACE_BINARY, init_btrace(log_file));
 }
 
 bool log_enable() {
@@ -14,8 +14,9 @@
 ***************************************************************************************/
 
 #include <utils.h>
+#include <context.h>
 
-NEMUState nemu_state = { .state = NEMU_STOP };
+NEMUContext nemu_ctx_default = NEMU_CTX_INIT;
 
 int is_exit_status_bad() {
   int good = (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ||
@@ -0,0 +1,112 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Render a binary trace written by NEMU (CONFIG_TRACE_BINARY) as text.
+// Usage: btrace-decoder FILE
+// Instructions are disassembled if NEMU's capstone has been built.
+
+#include <btrace-def.h>
+#include <capstone/capstone.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static cs_err (*cs_open_dl)(cs_arch arch, cs_mode mode, csh *handle);
+static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code, size_t code_size,
+    uint64_t address, size_t count, cs_insn **insn);
+static void (*cs_free_dl)(cs_insn *insn, size_t count);
+static csh handle;
+static bool has_capstone = false;
+
+static void init_capstone() {
+  const char *home = getenv("NEMU_HOME");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/tools/capstone/repo/libcapstone.so.5", home ? home : ".");
+  void *dl = dlopen(path, RTLD_LAZY);
+  if (dl == NULL) return;
+  cs_open_dl = dlsym(dl, "cs_open");
+  cs_disasm_dl = dlsym(dl, "cs_disasm");
+  cs_free_dl = dlsym(dl, "cs_free");
+  if (!cs_open_dl || !cs_disasm_dl || !cs_free_dl) return;
+  has_capstone = cs_open_dl(CS_ARCH_RISCV, CS_MODE_RISCV32 | CS_MODE_RISCVC, &handle) == CS_ERR_OK;
+}
+
+static void disassemble(char *str, int size, uint32_t pc, uint32_t inst, int len) {
+  str[0] = '\0';
+  if (!has_capstone) return;
+  cs_insn *insn;
+  size_t count = cs_disasm_dl(handle, (uint8_t *)&inst, len, pc, 0, &insn);
+  if (count != 1) return;
+  snprintf(str, size, "%s\t%s", insn->mnemonic, insn->op_str);
+  cs_free_dl(insn, count);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    perror("fopen");
+    return 1;
+  }
+
+  btrace_header_t h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, BTRACE_MAGIC, sizeof(BTRACE_MAGIC)) != 0 ||
+      h.version != BTRACE_VERSION || h.rec_size != sizeof(btrace_rec_t)) {
+    fprintf(stderr, "%s: not a NEMU binary trace (or version mismatch)\n", argv[1]);
+    return 1;
+  }
+
+  init_capstone();
+
+  btrace_rec_t rec[4096];
+  size_t n;
+  while ((n = fread(rec, sizeof(rec[0]), sizeof(rec) / sizeof(rec[0]), fp)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      btrace_rec_t *r = &rec[i];
+      char buf[192];
+      switch (r->type) {
+        case BTRACE_INST:
+          disassemble(buf, sizeof(buf), r->pc, r->data, r->len);
+          printf("[%" PRIu64 "] 0x%08x: %08x  %s\n", r->icount, r->pc, r->data, buf);
+          break;
+        case BTRACE_MEM_READ:
+        case BTRACE_MEM_WRITE:
+        case BTRACE_DEV_READ:
+        case BTRACE_DEV_WRITE: {
+          static const char *name[] = {
+            [BTRACE_MEM_READ] = "MTRACE read ", [BTRACE_MEM_WRITE] = "MTRACE write",
+            [BTRACE_DEV_READ] = "DTRACE read ", [BTRACE_DEV_WRITE] = "DTRACE write",
+          };
+          printf("[%" PRIu64 "] 0x%08x: %s addr=0x%08x len=%d data=0x%08x\n",
+              r->icount, r->pc, name[r->type], r->addr, r->len, r->data);
+          break;
+        }
+        default:
+          fprintf(stderr, "Unknown record type %d\n", r->type);
+          return 1;
+      }
+    }
+  }
+
+  fclose(fp);
+  return 0;
+}
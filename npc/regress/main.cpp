@@ -0,0 +1,437 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+// Parallel regression runner.
+//
+// Reads test lists (`NAME IMAGE` or just `IMAGE` per line, `#` starts a
+// comment), runs every image on the simulator with N workers, and writes one
+// JSON report (and optionally a JUnit XML report) to the output directory.
+//
+// NPC (fast mode) reports its counters through `-s STATISTICS_FILE`; NEMU has
+// no statistics file, so with `--nemu` the instruction count is scraped from
+// the log line printed by `statistic()`.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "utils/test_list.hpp"
+
+enum class Status { PASS, FAIL, TIMEOUT, ERROR };
+
+static const char* status_name(Status s)
+{
+    switch (s)
+    {
+    case Status::PASS: return "pass";
+    case Status::FAIL: return "fail";
+    case Status::TIMEOUT: return "timeout";
+    case Status::ERROR: return "error";
+    }
+    return "unknown";
+}
+
+struct Test
+{
+    std::string name;
+    std::string image;
+
+    Status status{Status::ERROR};
+    int exit_code{-1};
+    uint64_t instructions{};
+    uint64_t cycles{};
+    uint64_t host_time_us{};
+    std::string log_path;
+    std::string stats_path;
+};
+
+static const char* sim_path = nullptr;
+static bool sim_is_nemu = false;
+static std::vector<std::string> sim_args;
+static unsigned jobs = 0;
+static unsigned timeout_s = 600;
+static std::string out_dir = "regress-out";
+static const char* junit_file = nullptr;
+static std::vector<Test> tests;
+
+static std::mutex print_mtx;
+
+static void split_args(const char* str, std::vector<std::string>& out)
+{
+    std::istringstream ss(str);
+    std::string tok;
+    while (ss >> tok)
+        out.push_back(tok);
+}
+
+static void load_list(const char* path)
+{
+    std::vector<TestListEntry> entries;
+    if (!load_test_list(path, entries))
+    {
+        fprintf(stderr, "Can not open test list '%s'\n", path);
+        exit(1);
+    }
+    for (auto& e : entries)
+    {
+        Test t;
+        t.name = std::move(e.name);
+        t.image = std::move(e.image);
+        tests.emplace_back(std::move(t));
+    }
+}
+
+static void parse_args(int argc, char* argv[])
+{
+    constexpr option table[] = {
+        {"sim", required_argument, nullptr, 'S'},
+        {"nemu", no_argument, nullptr, 'n'},
+        {"args", required_argument, nullptr, 'a'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"timeout", required_argument, nullptr, 't'},
+        {"output", required_argument, nullptr, 'o'},
+        {"junit", required_argument, nullptr, 'J'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int o;
+    while ((o = getopt_long(argc, argv, "S:na:j:t:o:J:h", table, nullptr)) != -1)
+    {
+        switch (o)
+        {
+        case 'S':
+            sim_path = optarg;
+            break;
+        case 'n':
+            sim_is_nemu = true;
+            break;
+        case 'a':
+            split_args(optarg, sim_args);
+            break;
+        case 'j':
+            jobs = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            break;
+        case 't':
+            timeout_s = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'J':
+            junit_file = optarg;
+            break;
+        default:
+            printf("Usage: %s --sim=SIM [OPTION...] LIST...\n", argv[0]);
+            printf("\t-S,--sim=SIM        Simulator binary (NPC fast mode or NEMU).\n");
+            printf("\t-n,--nemu           SIM is NEMU; read counters from its log.\n");
+            printf("\t-a,--args=ARGS      Extra arguments passed to SIM before the image.\n");
+            printf("\t-j,--jobs=N         Number of workers (default: number of cores).\n");
+            printf("\t-t,--timeout=SEC    Per-test timeout in seconds, 0 to disable (default: 600).\n");
+            printf("\t-o,--output=DIR     Directory for logs and reports (default: regress-out).\n");
+            printf("\t-J,--junit=FILE     Also write a JUnit XML report to FILE.\n");
+            exit(0);
+        }
+    }
+
+    if (sim_path == nullptr)
+    {
+        fprintf(stderr, "Expected --sim=SIM\n");
+        exit(1);
+    }
+    for (int i = optind; i < argc; i++)
+        load_list(argv[i]);
+    if (tests.empty())
+    {
+        fprintf(stderr, "No test to run\n");
+        exit(1);
+    }
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The statistics file is the flat object written by
+// `SimHandle::dump_statistics_json`, so a key lookup is all we need.
+static bool json_u64(const std::string& json, const char* key, uint64_t& val)
+{
+    auto pattern = std::string("\"") + key + "\":";
+    auto pos = json.find(pattern);
+    if (pos == std::string::npos)
+        return false;
+    val = strtoull(json.c_str() + pos + pattern.size(), nullptr, 10);
+    return true;
+}
+
+// NEMU prints numbers with the thousands separator of the current locale.
+static bool log_u64(const std::string& log, const char* prefix, uint64_t& val)
+{
+    auto pos = log.rfind(prefix);
+    if (pos == std::string::npos)
+        return false;
+    val = 0;
+    for (auto p = pos + strlen(prefix); p < log.size(); p++)
+    {
+        char c = log[p];
+        if (c >= '0' && c <= '9')
+            val = val * 10 + (c - '0');
+        else if (c != ',' && c != '.' && c != '\'' && c != ' ')
+            break;
+    }
+    return true;
+}
+
+static void run_test(Test& t)
+{
+    std::string file_name = t.name;
+    for (auto& c : file_name)
+        if (c == '/')
+            c = '_';
+    t.log_path = out_dir + "/" + file_name + ".log";
+    if (!sim_is_nemu)
+    {
+        t.stats_path = out_dir + "/" + file_name + ".json";
+        unlink(t.stats_path.c_str());
+    }
+
+    std::vector<std::string> args{sim_path, "-b"};
+    if (!sim_is_nemu)
+    {
+        args.emplace_back("-s");
+        args.push_back(t.stats_path);
+    }
+    args.insert(args.end(), sim_args.begin(), sim_args.end());
+    args.push_back(t.image);
+
+    std::vector<char*> argv;
+    for (auto& a : args)
+        argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        t.status = Status::ERROR;
+        return;
+    }
+    if (pid == 0)
+    {
+        // Own process group, so that a timeout also kills anything SIM spawned.
+        setpgid(0, 0);
+        int fd = open(t.log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    setpgid(pid, pid);
+
+    auto deadline = begin + std::chrono::seconds(timeout_s);
+    int wstatus = 0;
+    bool timed_out = false;
+    while (true)
+    {
+        auto r = waitpid(pid, &wstatus, WNOHANG);
+        if (r == pid)
+            break;
+        if (r < 0 && errno != EINTR)
+        {
+            t.status = Status::ERROR;
+            return;
+        }
+        if (timeout_s != 0 && !timed_out && std::chrono::steady_clock::now() > deadline)
+        {
+            kill(-pid, SIGKILL);
+            timed_out = true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    t.host_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+
+    std::string log;
+    read_text_file(t.log_path, log);
+
+    if (sim_is_nemu)
+        log_u64(log, "total guest instructions = ", t.instructions);
+    else
+    {
+        std::string stats;
+        if (read_text_file(t.stats_path, stats))
+        {
+            json_u64(stats, "all_ops", t.instructions);
+            json_u64(stats, "all_cycles", t.cycles);
+        }
+    }
+
+    if (timed_out)
+        t.status = Status::TIMEOUT;
+    else if (WIFEXITED(wstatus))
+    {
+        t.exit_code = WEXITSTATUS(wstatus);
+        // NPC exits with 0 on a bad trap, so the trap message decides.
+        bool good_trap = log.find("HIT GOOD TRAP") != std::string::npos;
+        t.status = t.exit_code == 0 && good_trap ? Status::PASS : Status::FAIL;
+    }
+    else
+        t.status = Status::ERROR;
+}
+
+static void worker(std::atomic<size_t>& next, std::atomic<size_t>& done)
+{
+    while (true)
+    {
+        auto idx = next.fetch_add(1, std::memory_order_relaxed);
+        if (idx >= tests.size())
+            return;
+
+        auto& t = tests[idx];
+        run_test(t);
+
+        auto n = done.fetch_add(1, std::memory_order_relaxed) + 1;
+        std::lock_guard lock(print_mtx);
+        printf("[%zu/%zu] %-32s %-7s %10.3f s\n", n, tests.size(), t.name.c_str(),
+               status_name(t.status), static_cast<double>(t.host_time_us) / 1e6);
+        fflush(stdout);
+    }
+}
+
+static void write_json(const char* path, uint64_t wall_us)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "Can not open '%s'\n", path);
+        return;
+    }
+
+    size_t passed = 0;
+    for (auto& t : tests)
+        passed += t.status == Status::PASS;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"simulator\": \"%s\",\n", report_escape(sim_path).c_str());
+    fprintf(fp, "  \"jobs\": %u,\n", jobs);
+    fprintf(fp, "  \"total\": %zu,\n", tests.size());
+    fprintf(fp, "  \"passed\": %zu,\n", passed);
+    fprintf(fp, "  \"wall_time_us\": %lu,\n", wall_us);
+    fprintf(fp, "  \"tests\": [\n");
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        auto& t = tests[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"image\": \"%s\", \"status\": \"%s\", \"exit_code\": %d, "
+                "\"instructions\": %lu, \"cycles\": %lu, \"host_time_us\": %lu, \"log\": \"%s\"}%s\n",
+                report_escape(t.name).c_str(), report_escape(t.image).c_str(), status_name(t.status),
+                t.exit_code, t.instructions, t.cycles, t.host_time_us, report_escape(t.log_path).c_str(),
+                i + 1 == tests.size() ? "" : ",");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+}
+
+static void write_junit(const char* path, uint64_t wall_us)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "Can not open '%s'\n", path);
+        return;
+    }
+
+    size_t failures = 0, errors = 0;
+    for (auto& t : tests)
+    {
+        failures += t.status == Status::FAIL;
+        errors += t.status == Status::TIMEOUT || t.status == Status::ERROR;
+    }
+
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(fp, "<testsuite name=\"regress\" tests=\"%zu\" failures=\"%zu\" errors=\"%zu\" time=\"%.3f\">\n",
+            tests.size(), failures, errors, static_cast<double>(wall_us) / 1e6);
+    for (auto& t : tests)
+    {
+        fprintf(fp, "  <testcase name=\"%s\" classname=\"%s\" time=\"%.3f\">\n",
+                report_escape(t.name, true).c_str(), sim_is_nemu ? "nemu" : "npc",
+                static_cast<double>(t.host_time_us) / 1e6);
+        fprintf(fp, "    <properties>\n");
+        fprintf(fp, "      <property name=\"image\" value=\"%s\"/>\n", report_escape(t.image, true).c_str());
+        fprintf(fp, "      <property name=\"instructions\" value=\"%lu\"/>\n", t.instructions);
+        fprintf(fp, "      <property name=\"cycles\" value=\"%lu\"/>\n", t.cycles);
+        fprintf(fp, "    </properties>\n");
+        if (t.status == Status::FAIL)
+            fprintf(fp, "    <failure message=\"exit code %d, see %s\"/>\n", t.exit_code,
+                    report_escape(t.log_path, true).c_str());
+        else if (t.status != Status::PASS)
+            fprintf(fp, "    <error message=\"%s, see %s\"/>\n", status_name(t.status),
+                    report_escape(t.log_path, true).c_str());
+        fprintf(fp, "  </testcase>\n");
+    }
+    fprintf(fp, "</testsuite>\n");
+    fclose(fp);
+}
+
+int main(int argc, char* argv[])
+{
+    parse_args(argc, argv);
+
+    if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Can not create '%s': %s\n", out_dir.c_str(), strerror(errno));
+        return 1;
+    }
+
+    printf("Running %zu tests on %s with %u workers\n", tests.size(), sim_path, jobs);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next{0}, done{0};
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, tests.size()); i++)
+        workers.emplace_back(worker, std::ref(next), std::ref(done));
+    for (auto& w : workers)
+        w.join();
+
+    auto wall_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin).count());
+
+    auto report = out_dir + "/report.json";
+    write_json(report.c_str(), wall_us);
+    if (junit_file)
+        write_junit(junit_file, wall_us);
+
+    size_t passed = 0;
+    for (auto& t : tests)
+        passed += t.status == Status::PASS;
+    printf("%zu/%zu passed in %.3f s, report: %s\n", passed, tests.size(),
+           static_cast<double>(wall_us) / 1e6, report.c_str());
+
+    return passed == tests.size() ? 0 : 1;
+}
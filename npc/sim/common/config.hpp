@@ -28,6 +28,12 @@
 #define CONFIG_SDRAM_CHIP_NUM 4
 #define CONFIG_SDRAM_SIZE (CONFIG_SDRAM_CHIP_SIZE * CONFIG_SDRAM_CHIP_NUM)
 
+// Back guest memory with transparent huge pages (madvise, 2 MB pages)
+// #define CONFIG_THP 1
+
+// SRAM bytes handed over by fast-forward (the SRAM of NEMU's ysyxSoC is 8 KB)
+#define CONFIG_FF_SRAM_SIZE 0x2000
+
 // Available in sdb/fast/nvboard
 // #define CONFIG_MTRACE 1
 
@@ -37,6 +43,8 @@
 #define CONFIG_WP_BP
 #define CONFIG_PERF_COUNTERS 1
 #define CONFIG_DIFFTEST 1
+// Run REF on a separate thread and only compare its commit records in `difftest_step`.
+// #define CONFIG_DIFFTEST_ASYNC 1
 // #define CONFIG_DIFFTEST_TRACE 1
 
 #endif
\ No newline at end of file
@@ -3,10 +3,13 @@
 
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 
 #include "config.hpp"
 #include "dut_proxy.hpp"
 
+#include <svdpi.h>
+
 extern "C" {
 void flash_read(int32_t addr, int32_t* data)
 {
@@ -39,6 +42,31 @@ void psram_write(int waddr, char wdata)
     return SIM.mem().write<char>(waddr + CONFIG_PSRAM_BASE /* same as flash*/, wdata, 0b1);
 }
 
+// Burst interface. A whole cache-line transfer is one DPI call, with the
+// address translated once, instead of one call per byte:
+//
+//   import "DPI-C" function void psram_read_burst(input int addr, input int len, output byte data[]);
+//   import "DPI-C" function void psram_write_burst(input int addr, input int len, input byte data[]);
+void psram_read_burst(int raddr, int len, const svOpenArrayHandle data)
+{
+    auto src = SIM.mem().checked_guest_to_host(raddr + CONFIG_PSRAM_BASE, len);
+    memcpy(svGetArrayPtr(data), src, len);
+}
+
+void psram_write_burst(int waddr, int len, const svOpenArrayHandle data)
+{
+    auto& mem = SIM.mem();
+    auto addr = waddr + CONFIG_PSRAM_BASE;
+    auto bytes = static_cast<const char*>(svGetArrayPtr(data));
+    if (mem.overlaps_watch(addr, len)) [[unlikely]]
+    {
+        for (int i = 0; i < len; i++)
+            mem.write<char>(addr + i, bytes[i], 0b1);
+        return;
+    }
+    memcpy(mem.checked_guest_to_host(addr, len), bytes, len);
+}
+
 // The SDRAM addr only has low 25-bit valid.
 // One chip -> 25-bit -> 32 MB
 // id is used to tell which chip is being accessed.
@@ -103,6 +131,54 @@ void sdram_write(int waddr, int16_t wdata, char mask, char id)
     SIM.mem().write<int16_t>(npc_addr, wdata, mask);
 }
 
+// Burst of `len` beats on one chip. Consecutive columns are 4 bytes apart in
+// the NPC address space (the other half-word lives on the bit-extend chip),
+// and a burst never leaves its row.
+//
+//   import "DPI-C" function void sdram_read_burst(input int addr, input byte id, input int len,
+//                                                 output shortint data[]);
+//   import "DPI-C" function void sdram_write_burst(input int addr, input byte id, input int len,
+//                                                  input shortint data[], input byte mask[]);
+static uint8_t* sdram_burst_base(int addr, char id, int len, uint32_t& npc_addr)
+{
+    assert(BITS(addr, 11, 2) + len <= 1024 && "SDRAM burst crosses a row");
+    npc_addr = convert_sdram_addr(addr, id);
+    return SIM.mem().checked_guest_to_host(npc_addr, (len - 1) * 4 + 2);
+}
+
+void sdram_read_burst(int raddr, char id, int len, const svOpenArrayHandle data)
+{
+    uint32_t npc_addr;
+    auto src = sdram_burst_base(raddr, id, len, npc_addr);
+    auto dst = static_cast<int16_t*>(svGetArrayPtr(data));
+    for (int i = 0; i < len; i++)
+        memcpy(&dst[i], src + i * 4, 2);
+}
+
+void sdram_write_burst(int waddr, char id, int len, const svOpenArrayHandle data, const svOpenArrayHandle mask)
+{
+    uint32_t npc_addr;
+    auto dst = sdram_burst_base(waddr, id, len, npc_addr);
+    auto src = static_cast<const int16_t*>(svGetArrayPtr(data));
+    auto masks = static_cast<const char*>(svGetArrayPtr(mask));
+    auto& mem = SIM.mem();
+    if (mem.overlaps_watch(npc_addr, (len - 1) * 4 + 2)) [[unlikely]]
+    {
+        for (int i = 0; i < len; i++)
+            mem.write<int16_t>(npc_addr + i * 4, src[i], masks[i]);
+        return;
+    }
+    for (int i = 0; i < len; i++)
+    {
+        auto m = static_cast<uint16_t>(DUTMemory::expand_mask[masks[i] & 0b11]);
+        uint16_t old, val;
+        memcpy(&old, dst + i * 4, 2);
+        memcpy(&val, &src[i], 2);
+        val = (old & ~m) | (val & m);
+        memcpy(dst + i * 4, &val, 2);
+    }
+}
+
 int pmem_read(int raddr)
 {
     raddr &= ~0x3u;
@@ -6,10 +6,19 @@
 
 #include <verilated.h>
 #include <verilated_syms.h>
+#ifdef SAVABLE
+#include <verilated_save.h>
+#endif
 #include <getopt.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <type_traits>
 #include <variant>
 
@@ -88,12 +97,12 @@ void CPUProxy::bind(const TOP_NAME* this_dut)
 
 uint64_t CPUProxy::inst_count() const
 {
-    return *bindings.perf_counters.all_ops;
+    return *bindings.perf_counters.all_ops - perf_base.all_ops;
 }
 
 uint64_t CPUProxy::cycle_count() const
 {
-    return *bindings.perf_counters.all_cycles;
+    return *bindings.perf_counters.all_cycles - perf_base.all_cycles;
 }
 
 uint32_t CPUProxy::reg(uint32_t idx) const
@@ -116,6 +125,32 @@ bool CPUProxy::is_csr_valid(uint32_t idx) const
     return bindings.csrs[idx] != nullptr;
 }
 
+CPUProxy::PerfCounterValues CPUProxy::perf_counters_raw() const
+{
+    PerfCounterValues ret{};
+#define PERF_COUNTER_TABLE_ENTRY(name) ret.name = *bindings.perf_counters.name;
+    PERF_COUNTER_TABLE
+#undef PERF_COUNTER_TABLE_ENTRY
+    return ret;
+}
+
+CPUProxy::PerfCounterValues CPUProxy::perf_counters() const
+{
+    auto ret = perf_counters_raw();
+#define PERF_COUNTER_TABLE_ENTRY(name) ret.name -= perf_base.name;
+    PERF_COUNTER_TABLE
+#undef PERF_COUNTER_TABLE_ENTRY
+    return ret;
+}
+
+void CPUProxy::read_perf_counters(uint64_t* out) const
+{
+    auto v = perf_counters();
+#define PERF_COUNTER_TABLE_ENTRY(name) *out++ = v.name;
+    PERF_COUNTER_TABLE
+#undef PERF_COUNTER_TABLE_ENTRY
+}
+
 void CPUProxy::dump_gprs(FILE* stream) const
 {
     for (int i = 0; i < 16; i++)
@@ -135,8 +170,8 @@ void CPUProxy::dump_csrs(FILE* stream) const
 void CPUProxy::dump_perf_counters(FILE* stream)
 {
 #ifdef CONFIG_PERF_COUNTERS
-    auto& b = bindings.perf_counters;
-#define PERF(name) fprintf(stream, TOSTRING(name) " = %lu\n", *b.name)
+    auto b = perf_counters();
+#define PERF(name) fprintf(stream, TOSTRING(name) " = %lu\n", b.name)
     PERF(ifu_fetched);
     PERF(lsu_read);
     PERF(lsu_write);
@@ -146,16 +181,16 @@ void CPUProxy::dump_perf_counters(FILE* stream)
     PERF(icache_miss);
 #undef PERF
 
-    auto all_ops_d = static_cast<double>(*b.all_ops);
-    auto all_cycles_d = static_cast<double>(*b.all_cycles);
+    auto all_ops_d = static_cast<double>(b.all_ops);
+    auto all_cycles_d = static_cast<double>(b.all_cycles);
 
     fprintf(stream, "+----------+----------+--------+\n");
     fprintf(stream, "| Type     |    Count | %%      |\n");
     fprintf(stream, "+----------+----------+--------+\n");
 #define PERF(display_name, name)  fprintf(stream, "| %-8s | %8lu | %05.2f%% |\n", \
     TOSTRING(display_name), \
-    *b.name##_ops, \
-    100.0 * (static_cast<double>(*b.name##_ops) / all_ops_d))
+    b.name##_ops, \
+    100.0 * (static_cast<double>(b.name##_ops) / all_ops_d))
 
     PERF(ALU, alu);
     PERF(Branch, br);
@@ -167,19 +202,19 @@ void CPUProxy::dump_perf_counters(FILE* stream)
 
     // AMAT = p * access_time + (1 - p) * (access_time + miss_penalty) = access_time + (1 - p) * miss_penalty
     auto access_time = 1;
-    auto miss_penalty = static_cast<double>(*b.icache_mem_access_cycles) / static_cast<double>(*b.icache_miss);
-    auto hit_rate = static_cast<double>(*b.icache_hit) / static_cast<double>(*b.ifu_fetched);
+    auto miss_penalty = static_cast<double>(b.icache_mem_access_cycles) / static_cast<double>(b.icache_miss);
+    auto hit_rate = static_cast<double>(b.icache_hit) / static_cast<double>(b.ifu_fetched);
     auto AMAT = hit_rate * access_time + (1.0 - hit_rate) * (access_time + miss_penalty);
     fprintf(stream, "icache hit rate = %f\n", hit_rate);
     fprintf(stream, "icache miss penalty = %f\n", miss_penalty);
     fprintf(stream, "icache AMAT = %f\n", AMAT);
 
-    auto idu_hazard = *b.idu_hazard_stall_cycles;
+    auto idu_hazard = b.idu_hazard_stall_cycles;
     auto idu_hazard_percent = (static_cast<double>(idu_hazard) / all_cycles_d) * 100.0;
     fprintf(stream, "IDU hazard stalled = %lu (%.2f %%)\n", idu_hazard, idu_hazard_percent);
 
-    auto mispredicted_br = *b.mispredicted_branches;
-    auto mispredicted_br_percent = (static_cast<double>(mispredicted_br) / static_cast<double>(*b.br_ops)) * 100.0;
+    auto mispredicted_br = b.mispredicted_branches;
+    auto mispredicted_br_percent = (static_cast<double>(mispredicted_br) / static_cast<double>(b.br_ops)) * 100.0;
     fprintf(stream, "Mispredicted branches = %lu (%.2f %%)\n", mispredicted_br, mispredicted_br_percent);
 #endif
 }
@@ -199,36 +234,65 @@ void CPUProxy::dump(FILE* stream)
     dump_perf_counters();
 }
 
+// Demand-zero anonymous memory: pages are only allocated when the guest
+// touches them, so short tests don't pay for the full 160 MB.
+static uint8_t* map_guest_memory(size_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(-1);
+    }
+    IFDEF(CONFIG_THP, madvise(p, size, MADV_HUGEPAGE));
+    return static_cast<uint8_t*>(p);
+}
+
 void DUTMemory::init(const std::string& filename)
 {
     printf("Initializing memory from %s\n", filename.c_str());
     FILE* fp = fopen(filename.c_str(), "rb");
     assert(fp);
 
-    mrom_data = static_cast<uint8_t*>(malloc(CONFIG_MROM_SIZE));
-    memset(mrom_data, 0, CONFIG_MROM_SIZE);
-
-    flash_data = static_cast<uint8_t*>(malloc(CONFIG_FLASH_SIZE));
-    memset(flash_data, 0, CONFIG_FLASH_SIZE);
-
-    psram_data = static_cast<uint8_t*>(malloc(CONFIG_PSRAM_SIZE));
-    memset(psram_data, 0, CONFIG_PSRAM_SIZE);
+    mrom_data = map_guest_memory(CONFIG_MROM_SIZE);
+    flash_data = map_guest_memory(CONFIG_FLASH_SIZE);
+    psram_data = map_guest_memory(CONFIG_PSRAM_SIZE);
+    sdram_data = map_guest_memory(CONFIG_SDRAM_SIZE);
 
-    sdram_data = static_cast<uint8_t*>(malloc(CONFIG_SDRAM_SIZE));
-    memset(sdram_data, 0, CONFIG_SDRAM_SIZE);
+    static_assert(CONFIG_MROM_SIZE <= 0x10000000 && CONFIG_FLASH_SIZE <= 0x10000000
+        && CONFIG_PSRAM_SIZE <= 0x10000000 && CONFIG_SDRAM_SIZE <= 0x10000000);
+    regions[CONFIG_MROM_BASE >> 28] = {mrom_data, CONFIG_MROM_BASE, CONFIG_MROM_SIZE};
+    regions[CONFIG_FLASH_BASE >> 28] = {flash_data, CONFIG_FLASH_BASE, CONFIG_FLASH_SIZE};
+    regions[CONFIG_PSRAM_BASE >> 28] = {psram_data, CONFIG_PSRAM_BASE, CONFIG_PSRAM_SIZE};
+    regions[CONFIG_SDRAM_BASE >> 28] = {sdram_data, CONFIG_SDRAM_BASE, CONFIG_SDRAM_SIZE};
 
     // ATTENTION: guest_to_host must be used after the initialization of `***_data`.
     auto dest_ptr = guest_to_host(RESET_VECTOR);
     auto [beg, end] = get_memory_area(RESET_VECTOR);
-    auto dest_size = end - beg;
-
-    size_t bytes_read = fread(dest_ptr, 1, dest_size, fp);
-    if (bytes_read == 0)
+    size_t dest_size = end - beg;
+
+    struct stat st{};
+    fstat(fileno(fp), &st);
+    size_t img_size = std::min(static_cast<size_t>(st.st_size), dest_size);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t map_size = (img_size + page_size - 1) & ~(page_size - 1);
+
+    // Map the image copy-on-write over the memory it is loaded into; fall back
+    // to fread() if the destination is not page-aligned.
+    size_t bytes_read;
+    if (img_size > 0 && map_size <= dest_size && (reinterpret_cast<uintptr_t>(dest_ptr) & (page_size - 1)) == 0
+        && mmap(dest_ptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(fp), 0) != MAP_FAILED)
+        bytes_read = img_size;
+    else
     {
-        if (ferror(stdin))
+        bytes_read = fread(dest_ptr, 1, dest_size, fp);
+        if (bytes_read == 0)
         {
-            perror("fread");
-            exit(-1);
+            if (ferror(fp))
+            {
+                perror("fread");
+                exit(-1);
+            }
         }
     }
 
@@ -236,38 +300,25 @@ void DUTMemory::init(const std::string& filename)
 
     printf("Read %zu bytes from %s\n", bytes_read, filename.c_str());
 
-    // printf("First 32 bytes:\n");
-    // for (int i = 0; i < 4; i++)
-    //     printf("%08x: %08x\n", i * 4, data[i]);
-
     fclose(fp);
 }
 
 void DUTMemory::destroy()
 {
-    if (flash_data)
+    auto unmap = [](uint8_t*& data, size_t size)
     {
-        free(flash_data);
-        flash_data = nullptr;
-    }
-
-    if (mrom_data)
-    {
-        free(mrom_data);
-        mrom_data = nullptr;
-    }
-
-    if (psram_data)
-    {
-        free(psram_data);
-        psram_data = nullptr;
-    }
-
-    if (sdram_data)
-    {
-        free(sdram_data);
-        sdram_data = nullptr;
-    }
+        if (data)
+        {
+            munmap(data, size);
+            data = nullptr;
+        }
+    };
+    unmap(flash_data, CONFIG_FLASH_SIZE);
+    unmap(mrom_data, CONFIG_MROM_SIZE);
+    unmap(psram_data, CONFIG_PSRAM_SIZE);
+    unmap(sdram_data, CONFIG_SDRAM_SIZE);
+    for (auto& r : regions)
+        r = {};
 }
 
 void DUTMemory::out_of_bound_abort(uint32_t addr)
@@ -276,6 +327,7 @@ void DUTMemory::out_of_bound_abort(uint32_t addr)
     printf("Out of bound memory access at addr=0x%08x\n, ifu_pc=0x%08x, lsu_pc=0x%08x",
            addr, cpu.ifu_pc(), cpu.lsu_pc());
     cpu.dump();
+    SIM.keep_trace();
     SIM.cleanup();
     exit(-1);
 }
@@ -333,57 +385,218 @@ std::tuple<uint32_t, uint32_t> DUTMemory::get_memory_area(uint32_t addr)
 
 uint8_t* DUTMemory::guest_to_host(uint32_t paddr) const
 {
-    if (in_mrom(paddr))
-        return reinterpret_cast<uint8_t*>(mrom_data) + paddr - CONFIG_MROM_BASE;
-    if (in_flash(paddr))
-        return reinterpret_cast<uint8_t*>(flash_data) + paddr - CONFIG_FLASH_BASE;
-    if (in_psram(paddr))
-        return reinterpret_cast<uint8_t*>(psram_data) + paddr - CONFIG_PSRAM_BASE;
-    if (in_sdram(paddr))
-        return reinterpret_cast<uint8_t*>(sdram_data) + paddr - CONFIG_SDRAM_BASE;
-
-    assert(0 && "Unknown memory region");
-    return nullptr;
+    const auto& r = regions[paddr >> 28];
+    assert(paddr - r.base < r.size && "Unknown memory region");
+    return r.host + (paddr - r.base);
 }
 
 uint32_t DUTMemory::host_to_guest(uint8_t* haddr) const
 {
-    auto haddr_u32 = in_flash(static_cast<uint32_t>(reinterpret_cast<uint64_t>(haddr)));
-    if (in_mrom(haddr_u32))
-        return haddr - reinterpret_cast<uint8_t*>(mrom_data) + CONFIG_MROM_BASE;
-    if (in_flash(haddr_u32))
-        return haddr - reinterpret_cast<uint8_t*>(flash_data) + CONFIG_FLASH_BASE;
-    if (in_psram(haddr_u32))
-        return haddr - reinterpret_cast<uint8_t*>(psram_data) + CONFIG_PSRAM_BASE;
-    if (in_sdram(haddr_u32))
-        return haddr - reinterpret_cast<uint8_t*>(sdram_data) + CONFIG_SDRAM_BASE;
+    for (const auto& r : regions)
+    {
+        if (r.size != 0 && haddr >= r.host && haddr < r.host + r.size)
+            return r.base + (haddr - r.host);
+    }
 
     assert(0 && "Unknown memory region");
     return 0;
 }
 
+const char* SimTrigger::parse(const char* spec)
+{
+    char* end;
+    if (strncmp(spec, "pc=", 3) == 0)
+    {
+        kind = Kind::PC;
+        value = strtoul(spec + 3, &end, 16);
+        if (end == spec + 3)
+            return nullptr;
+    }
+    else
+    {
+        kind = Kind::Cycle;
+        value = strtoull(spec, &end, 0);
+        if (end == spec)
+            return nullptr;
+    }
+    return end;
+}
+
+bool SimHandle::set_trace_start(const char* spec)
+{
+    auto end = trace_start.parse(spec);
+    return end && *end == '\0';
+}
+
+bool SimHandle::set_trace_stop(const char* spec)
+{
+    auto end = trace_stop.parse(spec);
+    return end && *end == '\0';
+}
+
+// `trace.fst` -> `trace-window0.fst`
+std::string SimHandle::trace_chunk_path(int idx) const
+{
+    std::string path = TOSTRING(TRACE_FILENAME);
+    auto dot = path.rfind('.');
+    if (dot == std::string::npos)
+        dot = path.size();
+    return path.substr(0, dot) + "-window" + std::to_string(idx) + path.substr(dot);
+}
+
 void SimHandle::init_trace()
 {
 #ifdef TRACE
-    tfp = new TFP_TYPE;
     Verilated::traceEverOn(true);
+    if (!trace_start.armed())
+        start_trace();
+#else
+    if (trace_start.armed() || trace_stop.armed() || trace_window != 0)
+        fprintf(stderr, "Warning: Ignoring trace options, the model is built without TRACE\n");
+#endif
+}
+
+void SimHandle::start_trace()
+{
+#ifdef TRACE
+    open_trace_file(trace_window ? trace_chunk_path(trace_chunk) : TOSTRING(TRACE_FILENAME));
+    trace_chunk_begin = cycle_counter;
+    tracing = true;
+#endif
+}
+
+// A closed VerilatedFstC can not be reopened reliably, so every file gets a new one.
+void SimHandle::open_trace_file(const std::string& path)
+{
+#ifdef TRACE
+    close_trace_file();
+    tfp = new TFP_TYPE;
     dut->trace(tfp, 0);
-    tfp->open(TOSTRING(TRACE_FILENAME));
+    tfp->open(path.c_str());
+#endif
+}
+
+void SimHandle::close_trace_file()
+{
+#ifdef TRACE
+    if (tfp == nullptr)
+        return;
+    tfp->close();
+    delete tfp;
+    tfp = nullptr;
+#endif
+}
+
+// Called every cycle in builds with TRACE.
+void SimHandle::update_trace()
+{
+#ifdef TRACE
+    if (trace_start.armed() && trace_start.reached(cycle_counter, cpu_proxy))
+    {
+        trace_start = {};
+        printf("Trace started at cycle %lu\n", cycle_counter);
+        start_trace();
+    }
+
+    if (!tracing)
+        return;
+
+    if (trace_stop.armed() && trace_stop.reached(cycle_counter, cpu_proxy))
+    {
+        trace_stop = {};
+        printf("Trace stopped at cycle %lu\n", cycle_counter);
+        close_trace_file();
+        tracing = false;
+        keep_trace();
+        return;
+    }
+
+    if (trace_window != 0 && cycle_counter - trace_chunk_begin >= trace_window)
+    {
+        trace_chunk ^= 1;
+        open_trace_file(trace_chunk_path(trace_chunk));
+        trace_chunk_begin = cycle_counter;
+    }
 #endif
 }
 
 void SimHandle::cleanup_trace()
 {
 #ifdef TRACE
-    if (tfp)
+    close_trace_file();
+    tracing = false;
+    if (trace_window != 0)
     {
-        tfp->close();
-        delete tfp;
-        tfp = nullptr;
+        // The current chunk is the newer one.
+        for (int idx : {trace_chunk ^ 1, trace_chunk})
+        {
+            auto path = trace_chunk_path(idx);
+            if (access(path.c_str(), F_OK) != 0)
+                continue;
+            if (trace_keep)
+                printf("Waveform window: %s\n", path.c_str());
+            else
+                remove(path.c_str());
+        }
     }
 #endif
 }
 
+// Pin the main thread and Verilator's worker threads (which exist once the
+// model is constructed) to the CPUs listed in $NPC_PIN_CPUS, e.g. "2,3,6-8".
+// Threads are assigned in creation order, so the main thread gets the first CPU.
+static void pin_threads()
+{
+    auto env = getenv("NPC_PIN_CPUS");
+    if (env == nullptr || *env == '\0')
+        return;
+
+    std::vector<int> cpus;
+    char* p = env;
+    while (true)
+    {
+        char* end;
+        int lo = static_cast<int>(strtol(p, &end, 10));
+        if (end == p)
+            break;
+        int hi = lo;
+        if (*end == '-')
+            hi = static_cast<int>(strtol(end + 1, &end, 10));
+        for (int c = lo; c <= hi; c++)
+            cpus.push_back(c);
+        if (*end != ',')
+            break;
+        p = end + 1;
+    }
+    if (cpus.empty())
+    {
+        fprintf(stderr, "Warning: Can not parse NPC_PIN_CPUS='%s'\n", env);
+        return;
+    }
+
+    std::vector<pid_t> tids;
+    DIR* dir = opendir("/proc/self/task");
+    if (dir == nullptr)
+        return;
+    while (auto entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+            tids.push_back(static_cast<pid_t>(atoi(entry->d_name)));
+    }
+    closedir(dir);
+    std::sort(tids.begin(), tids.end());
+
+    for (size_t i = 0; i < tids.size(); i++)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % cpus.size()], &set);
+        if (sched_setaffinity(tids[i], sizeof(set), &set) != 0)
+            perror("sched_setaffinity");
+    }
+    printf("Pinned %zu threads to CPUs %s\n", tids.size(), env);
+}
+
 void SimHandle::init_sim(TOP_NAME* dut_, const char* img_path_, const char* statistics_path_)
 {
     // img_path can not be null
@@ -395,12 +608,15 @@ void SimHandle::init_sim(TOP_NAME* dut_, const char* img_path_, const char* stat
     dut = dut_;
     cpu_proxy.bind(dut_);
     cycle_counter = 0;
+    cycle_base = 0;
     sim_time = 0;
 
     init_trace();
 
     memory.init(img_path);
 
+    pin_threads();
+
     boot_timepoint = std::chrono::high_resolution_clock::now();
 
 #define CSR_TABLE_ENTRY(name, idx) csr_names[idx] = #name;
@@ -408,8 +624,24 @@ void SimHandle::init_sim(TOP_NAME* dut_, const char* img_path_, const char* stat
 #undef CSR_TABLE_ENTRY
 }
 
+void SimHandle::load_image(const char* img_path_, const char* statistics_path_)
+{
+    assert(img_path_ != nullptr);
+    img_path = img_path_;
+    statistics_path = statistics_path_ ? statistics_path_ : "";
+
+    memory.destroy();
+    memory.init(img_path);
+    cycle_counter = 0;
+    cycle_base = 0;
+    cpu_proxy.rebase_perf_counters();
+    got_ebreak = false;
+    boot_timepoint = std::chrono::high_resolution_clock::now();
+}
+
 void SimHandle::cleanup()
 {
+    finish_perf_samples();
     cleanup_trace();
     memory.destroy();
 }
@@ -421,18 +653,30 @@ void SimHandle::single_cycle()
     dut->clock = 1;
     dut->eval();
 
-    IFDEF(TRACE, tfp->dump(sim_time++));
+    IFDEF(TRACE, if (tracing) tfp->dump(sim_time));
+    IFDEF(TRACE, sim_time++);
 
     dut->clock = 0;
     dut->eval();
 
-    IFDEF(TRACE, tfp->dump(sim_time++));
+    IFDEF(TRACE, if (tracing) tfp->dump(sim_time));
+    IFDEF(TRACE, sim_time++);
 
     cycle_counter++;
+    check_perf_sample();
+
+    IFDEF(TRACE, update_trace());
 }
 
 void SimHandle::drain()
 {
+    // Keep the save point check out of the common loop.
+    while (!got_ebreak && save_point.when.armed())
+    {
+        single_cycle();
+        check_save_point();
+    }
+
     while (!got_ebreak)
         single_cycle();
 }
@@ -453,6 +697,232 @@ void SimHandle::reset(int n)
     dut->reset = 0;
 }
 
+// Checkpoint layout, after Verilator's own header:
+//   magic, cycle_counter, cycle_base, sim_time, inst_memory_size, the perf counter base,
+//   the number of memory regions and their (base, size), then for every region its non-zero
+//   pages as (offset, length, bytes) runs, terminated by a zero length, and the model last.
+// Everything but the model is checked and staged before any state is replaced.
+#ifdef SAVABLE
+static constexpr uint64_t checkpoint_magic = 0x33544b4357554c42; // "BLUWCKT3"
+static constexpr uint32_t checkpoint_page = 4096;
+
+static bool is_zero_page(const uint8_t* p)
+{
+    return p[0] == 0 && memcmp(p, p + 1, checkpoint_page - 1) == 0;
+}
+
+// Verilator's `operator<<`/`operator>>` only take non-const lvalues.
+template <typename T>
+static void save_value(VerilatedSave& os, T val)
+{
+    os.write(&val, sizeof(val));
+}
+
+template <typename T>
+static T restore_value(VerilatedRestore& is)
+{
+    T val;
+    is.read(&val, sizeof(val));
+    return val;
+}
+#endif
+
+bool SimHandle::save_checkpoint(const std::string& path)
+{
+#ifdef SAVABLE
+    VerilatedSave os;
+    os.open(path.c_str());
+    if (!os.isOpen())
+    {
+        fprintf(stderr, "Can not open checkpoint file '%s'\n", path.c_str());
+        return false;
+    }
+
+    save_value(os, checkpoint_magic);
+    save_value(os, cycle_counter);
+    save_value(os, cycle_base);
+    save_value(os, sim_time);
+    save_value<uint64_t>(os, memory.inst_memory_size);
+    save_value(os, cpu_proxy.perf_counters_base());
+
+    uint32_t nr_region = 0;
+    for (const auto& r : memory.regions)
+        nr_region += r.size != 0;
+    save_value(os, nr_region);
+    for (const auto& r : memory.regions)
+    {
+        if (r.size == 0)
+            continue;
+        save_value(os, r.base);
+        save_value(os, r.size);
+    }
+
+    for (const auto& r : memory.regions)
+    {
+        if (r.size == 0)
+            continue;
+        for (uint32_t off = 0; off < r.size;)
+        {
+            if (is_zero_page(r.host + off))
+            {
+                off += checkpoint_page;
+                continue;
+            }
+            uint32_t end = off + checkpoint_page;
+            while (end < r.size && !is_zero_page(r.host + end))
+                end += checkpoint_page;
+            save_value(os, off);
+            save_value(os, end - off);
+            os.write(r.host + off, end - off);
+            off = end;
+        }
+        save_value<uint32_t>(os, 0);
+        save_value<uint32_t>(os, 0);
+    }
+    os << *dut;
+    os.close();
+
+    printf("Checkpoint saved to '%s' at cycle %lu\n", path.c_str(), cycle_counter);
+    return true;
+#else
+    fprintf(stderr, "Checkpoints are not supported by this model, rebuild it with SAVABLE=true\n");
+    return false;
+#endif
+}
+
+bool SimHandle::restore_checkpoint(const std::string& path)
+{
+#ifdef SAVABLE
+    VerilatedRestore is;
+    is.open(path.c_str());
+    if (!is.isOpen())
+    {
+        fprintf(stderr, "Can not open checkpoint file '%s'\n", path.c_str());
+        return false;
+    }
+
+    if (restore_value<uint64_t>(is) != checkpoint_magic)
+    {
+        fprintf(stderr, "'%s' is not a checkpoint of this simulator version\n", path.c_str());
+        return false;
+    }
+    auto new_cycle_counter = restore_value<uint64_t>(is);
+    auto new_cycle_base = restore_value<uint64_t>(is);
+    auto new_sim_time = restore_value<uint64_t>(is);
+    auto new_inst_memory_size = restore_value<uint64_t>(is);
+    auto new_perf_base = restore_value<CPUProxy::PerfCounterValues>(is);
+
+    std::vector<const DUTMemory::Region*> regions;
+    for (const auto& r : memory.regions)
+    {
+        if (r.size != 0)
+            regions.push_back(&r);
+    }
+    if (restore_value<uint32_t>(is) != regions.size())
+    {
+        fprintf(stderr, "Checkpoint '%s' does not match the memory regions of this model\n", path.c_str());
+        return false;
+    }
+    for (auto r : regions)
+    {
+        auto base = restore_value<uint32_t>(is);
+        auto size = restore_value<uint32_t>(is);
+        if (base != r->base || size != r->size)
+        {
+            fprintf(stderr, "Checkpoint region 0x%08x+0x%x does not match 0x%08x+0x%x\n",
+                    base, size, r->base, r->size);
+            return false;
+        }
+    }
+
+    // Read every region into fresh demand-zero pages first, they replace the live ones below.
+    std::vector<uint8_t*> staged;
+    auto drop_staged = [&]
+    {
+        for (size_t i = 0; i < staged.size(); i++)
+            munmap(staged[i], regions[i]->size);
+    };
+    for (auto r : regions)
+    {
+        void* buf = mmap(nullptr, r->size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (buf == MAP_FAILED)
+        {
+            perror("mmap");
+            drop_staged();
+            return false;
+        }
+        staged.push_back(static_cast<uint8_t*>(buf));
+
+        while (true)
+        {
+            auto off = restore_value<uint32_t>(is);
+            auto len = restore_value<uint32_t>(is);
+            if (len == 0)
+                break;
+            if (off > r->size || r->size - off < len || !is.isOpen())
+            {
+                fprintf(stderr, "Checkpoint '%s' is corrupt in region 0x%08x\n", path.c_str(), r->base);
+                drop_staged();
+                return false;
+            }
+            is.read(staged.back() + off, len);
+        }
+    }
+    if (!is.isOpen())
+    {
+        fprintf(stderr, "Checkpoint '%s' is truncated\n", path.c_str());
+        drop_staged();
+        return false;
+    }
+
+    // Everything is checked, replace the state. The model comes last in the file.
+    is >> *dut;
+    is.close();
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        auto r = regions[i];
+        if (mremap(staged[i], r->size, r->size, MREMAP_MAYMOVE | MREMAP_FIXED, r->host) == MAP_FAILED)
+        {
+            memcpy(r->host, staged[i], r->size);
+            munmap(staged[i], r->size);
+        }
+        IFDEF(CONFIG_THP, madvise(r->host, r->size, MADV_HUGEPAGE));
+    }
+    cycle_counter = new_cycle_counter;
+    cycle_base = new_cycle_base;
+    sim_time = new_sim_time;
+    memory.inst_memory_size = new_inst_memory_size;
+    cpu_proxy.set_perf_counters_base(new_perf_base);
+
+    got_ebreak = false;
+    mark_perf_phase("restore");
+    printf("Checkpoint restored from '%s' at cycle %lu\n", path.c_str(), cycle_counter);
+    return true;
+#else
+    fprintf(stderr, "Checkpoints are not supported by this model, rebuild it with SAVABLE=true\n");
+    return false;
+#endif
+}
+
+bool SimHandle::set_save_point(const char* spec)
+{
+    auto end = save_point.when.parse(spec);
+    if (end == nullptr || end[0] != ':' || end[1] == '\0')
+    {
+        save_point.when = {};
+        return false;
+    }
+    save_point.path = end + 1;
+    return true;
+}
+
+void SimHandle::take_save_point()
+{
+    save_point.when = {};
+    save_checkpoint(save_point.path);
+}
+
 void SimHandle::dump_after_ebreak()
 {
     auto a0 = cpu().reg(10);
@@ -460,7 +930,10 @@ void SimHandle::dump_after_ebreak()
     if (a0 == 0)
         printf("\33[1;32mHIT GOOD TRAP\33[0m at exu_pc = 0x%x\n", exu_pc);
     else
+    {
         printf("\33[1;41mHIT BAD TRAP\33[0m at exu_pc = 0x%x, a0=%d\n", exu_pc, a0);
+        keep_trace();
+    }
 
     printf("Ebreak after %lu cycles\n", simulator_cycles());
     printf("Statistics:\n");
@@ -517,7 +990,8 @@ void SimHandle::dump_statistics_json(FILE* stream) const
     emit("elapsed_time", elapsed_time());
     emit("simulator_cycles", simulator_cycles());
 
-#define PERF_COUNTER_TABLE_ENTRY(name) emit(TOSTRING(name), *c.bindings.perf_counters.name);
+    auto counters = c.perf_counters();
+#define PERF_COUNTER_TABLE_ENTRY(name) emit(TOSTRING(name), counters.name);
     PERF_COUNTER_TABLE
 #undef PERF_COUNTER_TABLE_ENTRY
 
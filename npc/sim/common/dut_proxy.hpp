@@ -7,6 +7,11 @@
 #include "utils/macro.hpp"
 #include "config.hpp"
 
+#include <array>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
 #include TOSTRING(TOP_NAME.h)
 
 #ifdef TRACE_fst
@@ -92,6 +97,18 @@ class CPUProxy
         } perf_counters;
     } bindings;
 
+public:
+    struct PerfCounterValues
+    {
+#define PERF_COUNTER_TABLE_ENTRY(name) uint64_t name;
+        PERF_COUNTER_TABLE
+#undef PERF_COUNTER_TABLE_ENTRY
+    };
+
+private:
+    // Subtracted from every reading, see `rebase_perf_counters`.
+    PerfCounterValues perf_base{};
+
 public:
     CPUProxy() = default;
 
@@ -110,6 +127,25 @@ public:
     [[nodiscard]] uint32_t reg(uint32_t idx) const;
     [[nodiscard]] uint32_t csr(uint32_t idx) const;
     [[nodiscard]] bool is_csr_valid(uint32_t idx) const;
+
+#define PERF_COUNTER_TABLE_ENTRY(name) +1
+    static constexpr size_t perf_counter_count = 0 PERF_COUNTER_TABLE;
+#undef PERF_COUNTER_TABLE_ENTRY
+    // Current values of PERF_COUNTER_TABLE, in table order.
+    void read_perf_counters(uint64_t* out) const;
+    [[nodiscard]] PerfCounterValues perf_counters() const;
+
+    // The counters of the model can not be written, so work that should not be
+    // counted (e.g. the restorer of a fast-forward) is hidden by starting from here.
+    void rebase_perf_counters() { perf_base = perf_counters_raw(); }
+    [[nodiscard]] PerfCounterValues perf_counters_raw() const;
+    [[nodiscard]] const PerfCounterValues& perf_counters_base() const { return perf_base; }
+    void set_perf_counters_base(const PerfCounterValues& base) { perf_base = base; }
+
+    // Where the value lives in the model, for compiled sdb expressions.
+    [[nodiscard]] const uint32_t* exu_pc_ptr() const { return bindings.exu_pc; }
+    [[nodiscard]] const uint32_t* reg_ptr(uint32_t idx) const { return bindings.gprs[idx]; }
+    [[nodiscard]] const uint32_t* csr_ptr(uint32_t idx) const { return bindings.csrs[idx]; }
 };
 
 struct DUTMemory
@@ -121,6 +157,27 @@ struct DUTMemory
 
     size_t inst_memory_size{};
 
+    // Every simulated memory lives in its own 256 MB window, so the top nibble
+    // of an address selects its region directly. Unused slots have size 0.
+    struct Region
+    {
+        uint8_t* host;
+        uint32_t base;
+        uint32_t size;
+    };
+
+    Region regions[16]{};
+
+    // The SRAM is part of the model. Its contents are only known here after a
+    // fast-forward, so difftest can hand them to the REF.
+    std::vector<uint8_t> sram_image;
+
+    // Writes overlapping [watch_lo, watch_hi) are reported to `write_watch`.
+    // Used by memory watchpoints in sdb; the range is empty by default.
+    uint32_t watch_lo{UINT32_MAX};
+    uint32_t watch_hi{0};
+    void (*write_watch)(uint32_t addr, uint32_t wdata, uint8_t wmask){};
+
     void init(const std::string& filename);
     void destroy();
 
@@ -132,31 +189,56 @@ struct DUTMemory
 
     [[noreturn]] static void out_of_bound_abort(uint32_t addr);
 
-    template <typename T>
-    T read(uint32_t uaddr)
+    // Translates [uaddr, uaddr + len) at once, so bursts pay for one lookup.
+    uint8_t* checked_guest_to_host(uint32_t uaddr, uint32_t len = 1) const
     {
-        if (!in_sim_mem(uaddr))
+        const auto& r = regions[uaddr >> 28];
+        uint32_t off = uaddr - r.base;
+        if (off >= r.size || r.size - off < len) [[unlikely]]
             out_of_bound_abort(uaddr);
+        return r.host + off;
+    }
 
-        return *reinterpret_cast<T*>(guest_to_host(uaddr));
+    [[nodiscard]] bool overlaps_watch(uint32_t uaddr, uint32_t len) const
+    {
+        return uaddr + len > watch_lo && uaddr < watch_hi;
     }
 
     template <typename T>
-    void write(uint32_t uaddr, T wdata, uint8_t wmask)
+    T read(uint32_t uaddr)
     {
-        if (!in_sim_mem(uaddr))
-            out_of_bound_abort(uaddr);
+        T ret;
+        memcpy(&ret, checked_guest_to_host(uaddr), sizeof(T));
+        return ret;
+    }
 
-        if (wmask == 0)
-            return;
+    // Byte mask (one bit per byte) -> bit mask, e.g. 0b0101 -> 0x00ff00ff.
+    static constexpr auto expand_mask = []
+    {
+        std::array<uint32_t, 16> table{};
+        for (uint32_t m = 0; m < 16; m++)
+            for (int i = 0; i < 4; i++)
+                if (m & (1 << i))
+                    table[m] |= 0xffu << (i * 8);
+        return table;
+    }();
 
-        auto haddr = guest_to_host(uaddr);
-        auto* u8data = reinterpret_cast<uint8_t*>(&wdata);
-        for (int i = 0; i < sizeof(T); i++)
-        {
-            if (wmask & (1 << i))
-                haddr[i] = u8data[i];
-        }
+    template <typename T>
+    void write(uint32_t uaddr, T wdata, uint8_t wmask)
+    {
+        static_assert(sizeof(T) <= 4);
+        using U = std::conditional_t<sizeof(T) == 1, uint8_t, std::conditional_t<sizeof(T) == 2, uint16_t, uint32_t>>;
+
+        auto haddr = checked_guest_to_host(uaddr);
+        auto m = static_cast<U>(expand_mask[wmask & ((1u << sizeof(T)) - 1)]);
+        U old, val;
+        memcpy(&old, haddr, sizeof(U));
+        memcpy(&val, &wdata, sizeof(U));
+        val = (old & ~m) | (val & m);
+        memcpy(haddr, &val, sizeof(U));
+
+        if (overlaps_watch(uaddr, sizeof(T)) && wmask != 0) [[unlikely]]
+            write_watch(uaddr, static_cast<uint32_t>(wdata), wmask);
     }
 
     static bool in_mrom(uint32_t addr);
@@ -171,24 +253,85 @@ struct DUTMemory
     [[nodiscard]] uint32_t host_to_guest(uint8_t* haddr) const;
 };
 
+// A point in the run: a cycle count, or the commit of the instruction at a pc.
+struct SimTrigger
+{
+    enum class Kind { None, Cycle, PC } kind{Kind::None};
+    uint64_t value{};
+
+    // SPEC is `CYCLES` or `pc=ADDR`, optionally followed by `:...`.
+    // Returns where parsing stopped, or nullptr on error.
+    const char* parse(const char* spec);
+
+    [[nodiscard]] bool armed() const { return kind != Kind::None; }
+
+    [[nodiscard]] bool reached(uint64_t cycles, const CPUProxy& cpu) const
+    {
+        return kind == Kind::Cycle ? cycles >= value : cpu.difftest_ready() && cpu.difftest_pc() == value;
+    }
+};
+
 class SimHandle
 {
     TOP_NAME* dut{};
     DUTMemory memory;
     CPUProxy cpu_proxy{};
     uint64_t cycle_counter{};
+    // `cycle_counter` when the statistics start, see `fast_forward`.
+    uint64_t cycle_base{};
     uint64_t sim_time{};
     uint32_t prev_inst{};
     IFDEF(TRACE, TFP_TYPE* tfp{});
+
+    // Waveform control, see `--trace-start`, `--trace-stop` and `--trace-window`.
+    // With a window, the waveform alternates between two chunk files of `trace_window` cycles,
+    // which are only kept if `keep_trace` is called. Every cycle is still dumped, the window
+    // only bounds the size of the waveform on disk.
+    SimTrigger trace_start;
+    SimTrigger trace_stop;
+    uint64_t trace_window{};
+    uint64_t trace_chunk_begin{};
+    int trace_chunk{};
+    bool tracing{};
+    bool trace_keep{};
     std::chrono::high_resolution_clock::time_point boot_timepoint;
     std::string img_path;
     std::string statistics_path;
 
-    std::atomic_bool got_ebreak;
+    // Set by the ebreak DPI-C call inside `eval`, which only returns after every model
+    // thread is done, so a plain flag is enough.
+    bool got_ebreak{};
+
+    // Checkpoint taken once while running, see `--save-at`.
+    struct SavePoint
+    {
+        SimTrigger when;
+        std::string path;
+    } save_point;
 
     void init_trace();
+    void start_trace();
+    void open_trace_file(const std::string& path);
+    void close_trace_file();
+    void update_trace();
+    [[nodiscard]] std::string trace_chunk_path(int idx) const;
+    void take_save_point();
     void cleanup_trace();
 
+    // Perf counter time series, see `--perf-interval` and sim/common/perf_samples.cpp.
+    uint64_t perf_interval{};
+    uint64_t perf_next{UINT64_MAX};
+    uint64_t perf_last{};
+    std::string perf_path{"perf.csv"};
+    // Whether `perf_path` was given as `CYCLES:FILE`.
+    bool perf_path_explicit{};
+    FILE* perf_fp{};
+    const char* perf_area{};
+    std::array<uint64_t, CPUProxy::perf_counter_count> perf_prev{};
+
+    void sample_perf();
+    void finish_perf_samples();
+
 #ifdef BAILUWAN_SIM_MODE
     static constexpr auto mode = TOSTRING(BAILUWAN_SIM_MODE);
 #else
@@ -211,9 +354,13 @@ public:
     SimHandle() = default;
 
     void init_sim(TOP_NAME* dut_, const char* img_path_, const char* statistics_path_);
+    // Replaces the memories with a fresh copy of another image, keeping the model as is.
+    void load_image(const char* img_path_, const char* statistics_path_);
     void cleanup();
     void single_cycle();
     void drain();
+    // The throughput loop of fast mode, see sim/fast/run.cpp
+    void run_fast();
     void reset(int n);
 
     void dump_after_ebreak();
@@ -221,9 +368,53 @@ public:
     void dump_statistics_json(FILE* stream = nullptr) const;
     void ebreak() { got_ebreak = true; }
 
+    // Checkpoints of the model, the simulated memories and the cycle counters.
+    // They need a model built with `SAVABLE=true` (Verilator's `--savable`).
+    bool save_checkpoint(const std::string& path);
+    bool restore_checkpoint(const std::string& path);
+
+    // Runs NEMU for SPEC (`N` instructions or `pc=ADDR`) and moves its architectural state
+    // into the model. Call it right after `reset`.
+    bool fast_forward(const char* spec);
+
+    // SPEC is `CYCLES:FILE` or `pc=ADDR:FILE`. The latter saves right after ADDR commits.
+    bool set_save_point(const char* spec);
+
+    // Checked every cycle by sdb; `drain` runs its own loop while a save point is armed.
+    void check_save_point()
+    {
+        if (!save_point.when.armed()) [[likely]]
+            return;
+        if (save_point.when.reached(cycle_counter, cpu_proxy))
+            take_save_point();
+    }
+
+    // Call before `init_sim`. Only takes effect in builds with TRACE.
+    bool set_trace_start(const char* spec);
+    bool set_trace_stop(const char* spec);
+    void set_trace_window(uint64_t cycles) { trace_window = cycles; }
+
+    // SPEC is `CYCLES` or `CYCLES:FILE`. Sampling starts with `start_perf_samples`.
+    bool set_perf_interval(const char* spec);
+    void set_perf_output(const std::string& path) { perf_path = path; }
+    [[nodiscard]] bool perf_output_is_explicit() const { return perf_path_explicit; }
+    // Opens the time series and takes the baseline. Call right before running.
+    void start_perf_samples();
+    // Writes a phase marker and restarts the current interval from here.
+    void mark_perf_phase(const char* name);
+
+    void check_perf_sample()
+    {
+        if (cycle_counter >= perf_next) [[unlikely]]
+            sample_perf();
+    }
+
+    // Something went wrong: keep the waveform window instead of deleting it.
+    void keep_trace() { trace_keep = true; }
+
     [[nodiscard]] bool has_got_ebreak() const { return got_ebreak; }
 
-    [[nodiscard]] uint64_t simulator_cycles() const { return cycle_counter; }
+    [[nodiscard]] uint64_t simulator_cycles() const { return cycle_counter - cycle_base; }
     CPUProxy& cpu() { return cpu_proxy; }
     [[nodiscard]] const CPUProxy& cpu() const { return cpu_proxy; }
     DUTMemory& mem() { return memory; }
@@ -0,0 +1,289 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+#include "config.hpp"
+#include "dut_proxy.hpp"
+
+#include <dlfcn.h>
+
+// Functional fast-forward:
+//   NEMU (through the nemu_*() API of the difftest library) runs the program up to the
+//   region of interest, then its memories are copied into `DUTMemory`. The registers of
+//   the model are only exposed read-only, so the rest of the state is loaded by the model
+//   itself: a restorer program written over the reset vector stores the SRAM, sets the
+//   CSRs and x2-x15, and jumps to a pad right before the target pc:
+//     target - 12: lui x1, ...
+//     target - 8:  addi x1, x1, ...
+//     target - 4:  fence.i
+//   The original bytes are put back once fence.i is fetched, and fence.i flushes the
+//   icache and falls through to the target.
+
+enum { NEMU_TO_DUT, NEMU_TO_REF };
+enum { NEMU_RUNNING, NEMU_STOP, NEMU_END, NEMU_ABORT, NEMU_QUIT };
+
+using nemu_create_t = void* (*)();
+using nemu_destroy_t = void (*)(void* ctx);
+using nemu_memcpy_t = void (*)(void* ctx, uint32_t addr, void* buf, size_t n, bool direction);
+using nemu_regcpy_t = void (*)(void* ctx, void* dut, bool direction);
+using nemu_exec_until_t = int (*)(void* ctx, uint32_t pc, uint64_t n);
+
+// Same as `diff_context_t` in NEMU
+struct nemu_context_t
+{
+    uint32_t gpr[32];
+    uint32_t pc;
+    uint32_t csr[4096];
+};
+
+namespace
+{
+    class Restorer
+    {
+        std::vector<uint32_t> code;
+
+        static int32_t lo12(uint32_t v)
+        {
+            return static_cast<int32_t>(v << 20) >> 20;
+        }
+
+        void lui(int rd, uint32_t v) { code.push_back(((v - lo12(v)) & 0xfffff000) | rd << 7 | 0x37); }
+        void addi(int rd, int rs1, int32_t imm) { code.push_back((imm & 0xfffu) << 20 | rs1 << 15 | rd << 7 | 0x13); }
+
+    public:
+        void li(int rd, uint32_t v)
+        {
+            lui(rd, v);
+            addi(rd, rd, lo12(v));
+        }
+
+        // x1 and x2 are clobbered
+        void store(uint32_t addr, uint32_t v)
+        {
+            li(1, v);
+            lui(2, addr);
+            auto imm = static_cast<uint32_t>(lo12(addr));
+            code.push_back((imm >> 5) << 25 | 1 << 20 | 2 << 15 | 0b010 << 12 | (imm & 0x1f) << 7 | 0x23);
+        }
+
+        // csrrw x0, csr, x1; x1 is clobbered
+        void csrw(uint32_t csr, uint32_t v)
+        {
+            li(1, v);
+            code.push_back(csr << 20 | 1 << 15 | 0b001 << 12 | 0x73);
+        }
+
+        // jalr x0, 0(x1); x1 is clobbered
+        void jump(uint32_t target)
+        {
+            lui(1, target);
+            code.push_back((lo12(target) & 0xfffu) << 20 | 1 << 15 | 0x67);
+        }
+
+        void fence_i() { code.push_back(0x0000100f); }
+
+        [[nodiscard]] const std::vector<uint32_t>& get() const { return code; }
+        [[nodiscard]] uint32_t size() const { return code.size() * 4; }
+    };
+}
+
+namespace
+{
+    // The handle-based interface of the REF, see nemu/src/cpu/difftest/ref.c.
+    // One instance, destroyed on every exit path.
+    class NEMUInstance
+    {
+        static constexpr auto so_file = "sim/common/lib/riscv32-nemu-interpreter-so";
+        void* handle{};
+
+        template <typename T>
+        bool load(T& fn, const char* name)
+        {
+            dlerror();
+            fn = reinterpret_cast<T>(dlsym(handle, name));
+            if (fn != nullptr)
+                return true;
+            fprintf(stderr, "%s: %s\n", so_file, dlerror());
+            fprintf(stderr, "The REF is too old for fast-forward, rebuild it with `make nemu-ref`\n");
+            return false;
+        }
+
+    public:
+        void* ctx{};
+        nemu_create_t create{};
+        nemu_destroy_t destroy{};
+        nemu_memcpy_t memcpy{};
+        nemu_regcpy_t regcpy{};
+        nemu_exec_until_t exec_until{};
+
+        bool open()
+        {
+            // Never unmapped, so nothing the REF left registered in this process (e.g. a signal
+            // handler from an older build) can run into a closed library.
+            handle = dlopen(so_file, RTLD_LAZY | RTLD_NODELETE);
+            if (handle == nullptr)
+            {
+                fprintf(stderr, "Can not load %s: %s\n", so_file, dlerror());
+                return false;
+            }
+            if (!load(create, "nemu_create") || !load(destroy, "nemu_destroy") || !load(memcpy, "nemu_memcpy")
+                || !load(regcpy, "nemu_regcpy") || !load(exec_until, "nemu_exec_until"))
+                return false;
+            ctx = create();
+            if (ctx == nullptr)
+            {
+                fprintf(stderr, "Can not create a NEMU instance\n");
+                return false;
+            }
+            return true;
+        }
+
+        ~NEMUInstance()
+        {
+            if (ctx != nullptr)
+                destroy(ctx);
+            if (handle != nullptr)
+                dlclose(handle);
+        }
+    };
+}
+
+bool SimHandle::fast_forward(const char* spec)
+{
+    uint32_t stop_pc = UINT32_MAX;
+    uint64_t n = UINT64_MAX;
+    char* end;
+    if (strncmp(spec, "pc=", 3) == 0)
+        stop_pc = strtoul(spec + 3, &end, 16);
+    else
+        n = strtoull(spec, &end, 0);
+    if (*end != '\0' || end == spec)
+    {
+        fprintf(stderr, "Bad fast-forward '%s', expected N or pc=ADDR\n", spec);
+        return false;
+    }
+
+    // Same initial state as the REF in difftest
+    static nemu_context_t ctx;
+    {
+        NEMUInstance nemu;
+        if (!nemu.open())
+            return false;
+
+        nemu.memcpy(nemu.ctx, RESET_VECTOR, memory.guest_to_host(RESET_VECTOR), memory.inst_memory_size, NEMU_TO_REF);
+        ctx = {};
+        ctx.pc = RESET_VECTOR;
+        for (int i = 0; i < 4096; i++)
+        {
+            if (cpu_proxy.is_csr_valid(i))
+                ctx.csr[i] = cpu_proxy.csr(i);
+        }
+        nemu.regcpy(nemu.ctx, &ctx, NEMU_TO_REF);
+
+        printf("Fast-forwarding with NEMU to %s\n", spec);
+        auto start = std::chrono::high_resolution_clock::now();
+        int state = nemu.exec_until(nemu.ctx, stop_pc, n);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        nemu.regcpy(nemu.ctx, &ctx, NEMU_TO_DUT);
+
+        if (state != NEMU_STOP)
+        {
+            fprintf(stderr, "The program ended during fast-forward\n");
+            return false;
+        }
+        if (stop_pc != UINT32_MAX && ctx.pc != stop_pc)
+        {
+            fprintf(stderr, "Fast-forward did not reach pc=0x%08x\n", stop_pc);
+            return false;
+        }
+        printf("NEMU stopped at pc=0x%08x after %lu us\n", ctx.pc, us);
+
+        // Memories. Only pages with data are written, so untouched ones stay unallocated.
+        static uint8_t page[4096];
+        for (const auto& r : memory.regions)
+        {
+            for (uint32_t off = 0; off < r.size; off += sizeof(page))
+            {
+                nemu.memcpy(nemu.ctx, r.base + off, page, sizeof(page), NEMU_TO_DUT);
+                if (page[0] != 0 || memcmp(page, page + 1, sizeof(page) - 1) != 0)
+                    memcpy(r.host + off, page, sizeof(page));
+                else if (memcmp(r.host + off, page, sizeof(page)) != 0)
+                    memset(r.host + off, 0, sizeof(page));
+            }
+        }
+        memory.sram_image.resize(CONFIG_FF_SRAM_SIZE);
+        nemu.memcpy(nemu.ctx, CONFIG_SRAM_BASE, memory.sram_image.data(), CONFIG_FF_SRAM_SIZE, NEMU_TO_DUT);
+    }
+
+    // Restorer
+    Restorer rs;
+    for (uint32_t off = 0; off < CONFIG_FF_SRAM_SIZE; off += 4)
+    {
+        uint32_t word;
+        memcpy(&word, memory.sram_image.data() + off, sizeof(word));
+        if (word != 0)
+            rs.store(CONFIG_SRAM_BASE + off, word);
+    }
+    // mcycle and the machine information registers are not writable.
+    for (uint32_t csr : {CSR_mstatus, CSR_mtvec, CSR_mepc, CSR_mcause, CSR_mtval})
+        rs.csrw(csr, ctx.csr[csr]);
+    for (int i = 2; i < 16; i++)
+        rs.li(i, ctx.gpr[i]);
+    if (!DUTMemory::in_sim_mem(ctx.pc))
+    {
+        fprintf(stderr, "Can not continue at pc=0x%08x outside the simulated memories\n", ctx.pc);
+        return false;
+    }
+    uint32_t pad = ctx.pc - 12;
+    rs.jump(pad);
+
+    Restorer pad_rs;
+    pad_rs.li(1, ctx.gpr[1]);
+    pad_rs.fence_i();
+
+    auto [pad_lo, pad_hi] = DUTMemory::get_memory_area(ctx.pc);
+    if (!DUTMemory::in_sim_mem(RESET_VECTOR + rs.size() - 1) || pad < pad_lo
+        || (pad < RESET_VECTOR + rs.size() && RESET_VECTOR < ctx.pc))
+    {
+        fprintf(stderr, "No room for the restorer at pc=0x%08x\n", ctx.pc);
+        return false;
+    }
+
+    auto rs_host = memory.checked_guest_to_host(RESET_VECTOR, rs.size());
+    auto pad_host = memory.checked_guest_to_host(pad, pad_rs.size());
+    std::vector<uint8_t> rs_saved(rs_host, rs_host + rs.size());
+    std::vector<uint8_t> pad_saved(pad_host, pad_host + pad_rs.size());
+    memcpy(rs_host, rs.get().data(), rs.size());
+    memcpy(pad_host, pad_rs.get().data(), pad_rs.size());
+
+    auto fence_pc = ctx.pc - 4;
+    bool fetched = false;
+    uint64_t limit = cycle_counter + 1000 * (rs.size() + pad_rs.size()) + 100000;
+    while (true)
+    {
+        single_cycle();
+        if (!fetched && cpu_proxy.exu_inst_trace_ready() && cpu_proxy.exu_pc() == fence_pc)
+        {
+            memcpy(rs_host, rs_saved.data(), rs_saved.size());
+            memcpy(pad_host, pad_saved.data(), pad_saved.size());
+            fetched = true;
+        }
+        if (fetched && cpu_proxy.difftest_ready() && cpu_proxy.difftest_pc() == fence_pc)
+            break;
+        if (cycle_counter > limit || got_ebreak)
+        {
+            fprintf(stderr, "The restorer did not finish, exu_pc=0x%08x\n", cpu_proxy.exu_pc());
+            memcpy(rs_host, rs_saved.data(), rs_saved.size());
+            memcpy(pad_host, pad_saved.data(), pad_saved.size());
+            return false;
+        }
+    }
+
+    printf("State injected after %lu cycles, continuing at pc=0x%08x\n", cycle_counter, ctx.pc);
+
+    // Statistics start at the region of interest.
+    cycle_base = cycle_counter;
+    cpu_proxy.rebase_perf_counters();
+    boot_timepoint = std::chrono::high_resolution_clock::now();
+    return true;
+}
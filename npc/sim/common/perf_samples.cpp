@@ -0,0 +1,114 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+#include "dut_proxy.hpp"
+
+// Perf counter time series (`--perf-interval`):
+//   Every `perf_interval` cycles the deltas of all PERF_COUNTER_TABLE counters are appended
+//   to a CSV, so the phases of a run (boot, init, kernels) show up instead of being averaged
+//   into the totals. Lines starting with `#` are ignored by CSV readers; `# phase CYCLE NAME`
+//   marks a phase. `start`, `restore` and `end` come from the simulator, the others name the
+//   memory the pc is in, e.g. `flash` -> `sdram` once the bootloader jumps to the program.
+//   The area is only looked at when a sample is taken, so such a marker is placed at the first
+//   sample after the jump, up to one interval late. Plot it with `make perf-plot PERF_CSV=...`.
+
+static const char* memory_area_name(uint32_t pc)
+{
+    if (DUTMemory::in_mrom(pc))
+        return "mrom";
+    if (DUTMemory::in_sram(pc))
+        return "sram";
+    if (DUTMemory::in_flash(pc))
+        return "flash";
+    if (DUTMemory::in_psram(pc))
+        return "psram";
+    if (DUTMemory::in_sdram(pc))
+        return "sdram";
+    return "other";
+}
+
+bool SimHandle::set_perf_interval(const char* spec)
+{
+    char* end;
+    perf_interval = strtoull(spec, &end, 0);
+    if (end != spec && *end == ':' && end[1] != '\0')
+    {
+        perf_path = end + 1;
+        perf_path_explicit = true;
+    }
+    else if (end == spec || *end != '\0')
+        perf_interval = 0;
+    return perf_interval != 0;
+}
+
+void SimHandle::start_perf_samples()
+{
+    if (perf_interval == 0)
+        return;
+
+    perf_fp = fopen(perf_path.c_str(), "w");
+    if (perf_fp == nullptr)
+    {
+        fprintf(stderr, "Warning: Can not open perf sample file: '%s'. Sampling disabled.\n", perf_path.c_str());
+        return;
+    }
+    printf("Sampling perf counters every %lu cycles to '%s'\n", perf_interval, perf_path.c_str());
+
+    fprintf(perf_fp, "# interval %lu\n", perf_interval);
+    fprintf(perf_fp, "cycle,area");
+#define PERF_COUNTER_TABLE_ENTRY(name) fprintf(perf_fp, "," TOSTRING(name));
+    PERF_COUNTER_TABLE
+#undef PERF_COUNTER_TABLE_ENTRY
+    fprintf(perf_fp, "\n");
+
+    perf_area = nullptr;
+    mark_perf_phase("start");
+}
+
+void SimHandle::mark_perf_phase(const char* name)
+{
+    if (perf_fp == nullptr)
+        return;
+
+    fprintf(perf_fp, "# phase %lu %s\n", cycle_counter, name);
+    cpu_proxy.read_perf_counters(perf_prev.data());
+    perf_last = cycle_counter;
+    perf_next = cycle_counter + perf_interval;
+}
+
+void SimHandle::sample_perf()
+{
+    std::array<uint64_t, CPUProxy::perf_counter_count> now{};
+    cpu_proxy.read_perf_counters(now.data());
+
+    // The area of the pc at this sample. Compare by pointer, the names are literals.
+    auto area = memory_area_name(cpu_proxy.exu_pc());
+    if (area != perf_area)
+    {
+        fprintf(perf_fp, "# phase %lu %s\n", cycle_counter, area);
+        perf_area = area;
+    }
+
+    fprintf(perf_fp, "%lu,%s", cycle_counter, area);
+    for (size_t i = 0; i < now.size(); i++)
+        fprintf(perf_fp, ",%lu", now[i] - perf_prev[i]);
+    fprintf(perf_fp, "\n");
+
+    perf_prev = now;
+    perf_last = cycle_counter;
+    perf_next = cycle_counter + perf_interval;
+}
+
+void SimHandle::finish_perf_samples()
+{
+    if (perf_fp == nullptr)
+        return;
+
+    // The last interval is usually a partial one.
+    if (cycle_counter > perf_last)
+        sample_perf();
+    fprintf(perf_fp, "# phase %lu end\n", cycle_counter);
+    fclose(perf_fp);
+    perf_fp = nullptr;
+    perf_next = UINT64_MAX;
+}
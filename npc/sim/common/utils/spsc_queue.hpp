@@ -0,0 +1,65 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+#ifndef BAILUWAN_SPSC_QUEUE_HPP
+#define BAILUWAN_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+// Bounded lock-free single-producer/single-consumer ring.
+// `N` must be a power of two. `head` is only written by the consumer and
+// `tail` only by the producer, so each side keeps a cached copy of the other
+// index and only touches the shared cache line when it looks full/empty.
+template <typename T, size_t N>
+class SPSCQueue
+{
+    static_assert((N & (N - 1)) == 0, "SPSCQueue size must be a power of two");
+
+    static constexpr size_t cache_line = 64;
+
+    alignas(cache_line) std::atomic<size_t> head{0};
+    alignas(cache_line) size_t cached_tail{0};
+    alignas(cache_line) std::atomic<size_t> tail{0};
+    alignas(cache_line) size_t cached_head{0};
+    alignas(cache_line) T slots[N];
+
+public:
+    // Producer side
+    bool push(const T& val)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head == N)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head == N)
+                return false;
+        }
+        slots[t & (N - 1)] = val;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& val)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        val = slots[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+#ifndef BAILUWAN_TEST_LIST_HPP
+#define BAILUWAN_TEST_LIST_HPP
+
+// Test lists and report helpers shared by the regression runner (regress/)
+// and `--multi` in fast mode. Header-only, since regress/ is built on its own.
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct TestListEntry
+{
+    std::string name;
+    std::string image;
+};
+
+// build/add-riscv32e-ysyxsoc.bin -> add-riscv32e-ysyxsoc
+inline std::string test_default_name(const std::string& image)
+{
+    auto slash = image.find_last_of('/');
+    auto base = slash == std::string::npos ? image : image.substr(slash + 1);
+    auto dot = base.find_last_of('.');
+    return dot == std::string::npos ? base : base.substr(0, dot);
+}
+
+// One test per line, `NAME IMAGE` or just `IMAGE`, `#` starts a comment.
+// Returns false if the list can not be opened.
+inline bool load_test_list(const char* path, std::vector<TestListEntry>& out)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.resize(hash);
+
+        std::istringstream ss(line);
+        std::string first, second;
+        if (!(ss >> first))
+            continue;
+        if (ss >> second)
+            out.push_back({first, second});
+        else
+            out.push_back({test_default_name(first), first});
+    }
+    return true;
+}
+
+inline bool read_text_file(const std::string& path, std::string& content)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+// Escape `str` for a JSON string, or for an XML attribute if `xml`.
+inline std::string report_escape(const std::string& str, bool xml = false)
+{
+    std::string ret;
+    for (char c : str)
+    {
+        if (xml)
+        {
+            switch (c)
+            {
+            case '<': ret += "&lt;"; break;
+            case '>': ret += "&gt;"; break;
+            case '&': ret += "&amp;"; break;
+            case '"': ret += "&quot;"; break;
+            default: ret += c; break;
+            }
+        }
+        else
+        {
+            if (c == '"' || c == '\\')
+                ret += '\\';
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+#endif
@@ -3,11 +3,25 @@
 
 #include "dut_proxy.hpp"
 #include "utils/disasm.hpp"
+#include "utils/test_list.hpp"
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
 
 static const char* img_file = nullptr;
 static const char* statistics_file = nullptr;
+static const char* restore_file = nullptr;
+static const char* fast_forward = nullptr;
+static const char* multi_list = nullptr;
+static const char* multi_output = "build/multi-out";
+static long multi_jobs = 0;
+static unsigned multi_timeout = 0;
 
 // Compatible with SDB
 static void parse_args(int argc, char* argv[])
@@ -17,10 +31,21 @@ static void parse_args(int argc, char* argv[])
         {"elf", required_argument, nullptr, 'e'},
         {"help", no_argument, nullptr, 'h'},
         {"statistics", no_argument, nullptr, 's'},
+        {"save-at", required_argument, nullptr, 'S'},
+        {"restore", required_argument, nullptr, 'R'},
+        {"fast-forward", required_argument, nullptr, 'F'},
+        {"trace-start", required_argument, nullptr, 'T'},
+        {"trace-stop", required_argument, nullptr, 'P'},
+        {"trace-window", required_argument, nullptr, 'W'},
+        {"perf-interval", required_argument, nullptr, 'I'},
+        {"multi", required_argument, nullptr, 'M'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"output", required_argument, nullptr, 'o'},
+        {"timeout", required_argument, nullptr, 't'},
         {nullptr, 0, nullptr, 0},
     };
     int o;
-    while ((o = getopt_long(argc, argv, "-bhe:s:", table, nullptr)) != -1)
+    while ((o = getopt_long(argc, argv, "-bhe:s:S:R:F:T:P:W:I:M:j:o:t:", table, nullptr)) != -1)
     {
         switch (o)
         {
@@ -31,29 +56,262 @@ static void parse_args(int argc, char* argv[])
         case 's':
             statistics_file = optarg;
             break;
+        case 'S':
+            if (!SIM.set_save_point(optarg))
+            {
+                printf("Bad --save-at '%s', expected CYCLES:FILE or pc=ADDR:FILE\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'R':
+            restore_file = optarg;
+            break;
+        case 'F':
+            fast_forward = optarg;
+            break;
+        case 'T':
+        case 'P':
+            if (!(o == 'T' ? SIM.set_trace_start(optarg) : SIM.set_trace_stop(optarg)))
+            {
+                printf("Bad trigger '%s', expected CYCLES or pc=ADDR\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'W':
+            SIM.set_trace_window(strtoull(optarg, nullptr, 0));
+            break;
+        case 'I':
+            if (!SIM.set_perf_interval(optarg))
+            {
+                printf("Bad --perf-interval '%s', expected CYCLES or CYCLES:FILE\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'M':
+            multi_list = optarg;
+            break;
+        case 'j':
+            multi_jobs = strtol(optarg, nullptr, 10);
+            break;
+        case 'o':
+            multi_output = optarg;
+            break;
+        case 't':
+            multi_timeout = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
         case 1:
             img_file = optarg;
             return;
         default:
             printf("Usage: %s [filename]\n", argv[0]);
             printf("\t-s,--statistics=STATISTIC_FILE   Save statistics to file.\n");
+            printf("\t-S,--save-at=CYCLES:FILE         Save a checkpoint after CYCLES cycles.\n");
+            printf("\t   --save-at=pc=ADDR:FILE        Save a checkpoint once ADDR commits.\n");
+            printf("\t-R,--restore=FILE                Start from a checkpoint.\n");
+            printf("\t-F,--fast-forward=N|pc=ADDR      Run the first N instructions (or up to ADDR) in NEMU.\n");
+            printf("\t-T,--trace-start=CYCLES|pc=ADDR  Start the waveform there.\n");
+            printf("\t-P,--trace-stop=CYCLES|pc=ADDR   Stop the waveform there.\n");
+            printf("\t-W,--trace-window=CYCLES         Only keep the last CYCLES to 2*CYCLES cycles of waveform,\n");
+            printf("\t                                 and only if the run fails or --trace-stop fires.\n");
+            printf("\t-I,--perf-interval=CYCLES[:FILE] Write perf counter deltas every CYCLES cycles to FILE\n");
+            printf("\t                                 (default: perf.csv, NAME.perf.csv in --multi).\n");
+            printf("\t-M,--multi=LIST                  Run every image in LIST (`NAME IMAGE` or `IMAGE` per line)\n");
+            printf("\t                                 in forked copies of one reset model.\n");
+            printf("\t-j,--jobs=N                      Children running at once in --multi, default: all CPUs.\n");
+            printf("\t-o,--output=DIR                  Logs, statistics and report.json of --multi.\n");
+            printf("\t-t,--timeout=SECONDS             Kill a --multi child after SECONDS.\n");
             exit(0);
         }
     }
 }
 
+// Batch mode (`--multi`):
+//   Constructing the model, binding the CPUProxy and resetting take longer than many small
+//   tests run, so they are done once. Every image then runs in a forked child, which maps
+//   the image copy-on-write over fresh memories (`SimHandle::load_image`). The model is
+//   single-threaded here: the worker threads of a `--threads` model do not survive fork().
+struct MultiTest
+{
+    std::string name;
+    std::string image;
+    pid_t pid{};
+    int status{};
+    std::chrono::steady_clock::time_point start;
+    uint64_t elapsed_us{};
+};
+
+static std::vector<MultiTest> read_multi_list(const char* path)
+{
+    std::vector<TestListEntry> entries;
+    if (!load_test_list(path, entries))
+    {
+        fprintf(stderr, "Can not open %s\n", path);
+        exit(-1);
+    }
+    std::vector<MultiTest> tests(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        tests[i].name = std::move(entries[i].name);
+        tests[i].image = std::move(entries[i].image);
+    }
+    return tests;
+}
+
+static const char* multi_result(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status) == 0 ? "pass" : "fail";
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM)
+        return "timeout";
+    return "crash";
+}
+
+[[noreturn]] static void run_multi_child(const MultiTest& t)
+{
+    auto prefix = std::string(multi_output) + "/" + t.name;
+    int fd = open((prefix + ".log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    if (multi_timeout != 0)
+        alarm(multi_timeout);
+
+    SIM.set_perf_output(prefix + ".perf.csv");
+    SIM.load_image(t.image.c_str(), (prefix + ".json").c_str());
+    SIM.start_perf_samples();
+    SIM.run_fast();
+    SIM.dump_after_ebreak();
+    auto a0 = SIM.cpu().reg(10);
+    SIM.cleanup();
+    fflush(stdout);
+    _exit(a0 == 0 ? 0 : 1);
+}
+
+static int run_multi()
+{
+#ifdef TRACE
+    fprintf(stderr, "--multi needs a notrace build\n");
+    return -1;
+#endif
+    auto tests = read_multi_list(multi_list);
+    if (tests.empty())
+    {
+        fprintf(stderr, "No image in %s\n", multi_list);
+        return -1;
+    }
+    mkdir(multi_output, 0755);
+    if (SIM.perf_output_is_explicit())
+        fprintf(stderr, "Warning: Ignoring the perf sample file given to --perf-interval, "
+                "--multi writes one per image to %s/NAME.perf.csv\n", multi_output);
+
+    SIM.init_sim(&DUT, tests[0].image.c_str(), nullptr);
+    SIM.reset(10);
+    if (DUT.contextp()->threads() > 1)
+    {
+        fprintf(stderr, "--multi needs a single-threaded model (THREADS=1)\n");
+        return -1;
+    }
+
+    long jobs = multi_jobs > 0 ? multi_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    printf("Running %zu images with %ld jobs\n", tests.size(), jobs);
+    fflush(stdout);
+    fflush(stderr);
+
+    size_t next = 0, done = 0, passed = 0;
+    long running = 0;
+    while (done < tests.size())
+    {
+        while (running < jobs && next < tests.size())
+        {
+            auto& t = tests[next++];
+            t.start = std::chrono::steady_clock::now();
+            t.pid = fork();
+            if (t.pid == 0)
+                run_multi_child(t);
+            if (t.pid < 0)
+            {
+                perror("fork");
+                exit(-1);
+            }
+            running++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            perror("waitpid");
+            exit(-1);
+        }
+        auto it = std::find_if(tests.begin(), tests.end(), [&](const MultiTest& t) { return t.pid == pid; });
+        if (it == tests.end())
+            continue;
+        it->status = status;
+        it->elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - it->start).count();
+        running--;
+        done++;
+
+        auto result = multi_result(status);
+        if (strcmp(result, "pass") == 0)
+            passed++;
+        printf("[%zu/%zu] %-40s %s\n", done, tests.size(), it->name.c_str(), result);
+        fflush(stdout);
+    }
+
+    auto report_path = std::string(multi_output) + "/report.json";
+    FILE* fp = fopen(report_path.c_str(), "w");
+    if (fp == nullptr)
+    {
+        perror("fopen");
+        return -1;
+    }
+    fprintf(fp, "{\n  \"total\": %zu,\n  \"passed\": %zu,\n  \"jobs\": %ld,\n  \"tests\": [\n",
+            tests.size(), passed, jobs);
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        const auto& t = tests[i];
+        std::string stats_str;
+        read_text_file(std::string(multi_output) + "/" + t.name + ".json", stats_str);
+        while (!stats_str.empty() && isspace(static_cast<unsigned char>(stats_str.back())))
+            stats_str.pop_back();
+
+        fprintf(fp, "    {\"name\": \"%s\", \"image\": \"%s\", \"result\": \"%s\", \"exit_code\": %d, "
+                "\"elapsed_us\": %lu, \"statistics\": %s}%s\n",
+                report_escape(t.name).c_str(), report_escape(t.image).c_str(), multi_result(t.status),
+                WIFEXITED(t.status) ? WEXITSTATUS(t.status) : -1, t.elapsed_us,
+                stats_str.empty() ? "null" : stats_str.c_str(), i + 1 == tests.size() ? "" : ",");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+
+    printf("%zu/%zu passed, report: %s\n", passed, tests.size(), report_path.c_str());
+    return passed == tests.size() ? 0 : 1;
+}
+
 int main(int argc, char* argv[])
 {
     Verilated::commandArgs(argc, argv);
     parse_args(argc, argv);
+    if (multi_list)
+        return run_multi();
     // INIT
     SIM.init_sim(&DUT, img_file, statistics_file);
     SIM.reset(10);
+    if (restore_file && !SIM.restore_checkpoint(restore_file))
+        return -1;
+    if (fast_forward && !SIM.fast_forward(fast_forward))
+        return -1;
+    SIM.start_perf_samples();
 
     // Simulate
     printf("Fast simulation started.\n");
 
-    SIM.drain();
+    SIM.run_fast();
     SIM.dump_after_ebreak();
+    SIM.cleanup();
     return 0;
 }
@@ -0,0 +1,63 @@
+// Copyright (c) 2025-2026 caozhanhao
+// SPDX-License-Identifier: MulanPSL-2.0
+
+#include "dut_proxy.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+// Cycles between two looks at the clock for the live report
+static constexpr uint64_t chunk_cycles = 1 << 16;
+
+void SimHandle::run_fast()
+{
+#ifdef TRACE
+    // Waveform builds need the per-edge dumps in `single_cycle`.
+    drain();
+#else
+    while (!got_ebreak && save_point.when.armed())
+    {
+        single_cycle();
+        check_save_point();
+    }
+
+    // Same as `single_cycle`, minus its assertion and the trace hooks, and with the
+    // cycle counter kept in a register for a chunk at a time. Chunks end at perf samples.
+    auto top = dut;
+    bool live = isatty(STDERR_FILENO);
+    bool reported = false;
+    auto last_tp = std::chrono::steady_clock::now();
+    uint64_t last_cycles = cycle_counter;
+    while (!got_ebreak)
+    {
+        uint64_t n = 0;
+        uint64_t limit = std::min(chunk_cycles, perf_next - cycle_counter);
+        do
+        {
+            top->clock = 1;
+            top->eval();
+            top->clock = 0;
+            top->eval();
+            n++;
+        } while (!got_ebreak && n < limit);
+        cycle_counter += n;
+        check_perf_sample();
+
+        if (!live)
+            continue;
+
+        auto now = std::chrono::steady_clock::now();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_tp).count();
+        if (us < 1000000)
+            continue;
+        fprintf(stderr, "\r%lu cycles, %.1f kHz   ", cycle_counter,
+                static_cast<double>(cycle_counter - last_cycles) * 1000.0 / static_cast<double>(us));
+        reported = true;
+        last_tp = now;
+        last_cycles = cycle_counter;
+    }
+    if (reported)
+        fputc('\n', stderr);
+#endif
+}
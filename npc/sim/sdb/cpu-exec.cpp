@@ -60,12 +60,14 @@ static void execute(uint64_t n)
         if (SIM.has_got_ebreak())
         {
             SIM.dump_after_ebreak();
+            IFDEF(CONFIG_FTRACE, ftrace_profile_display(cpu.inst_count()));
 
             sdb_state = SDBState::End;
             sdb_halt_ret = static_cast<int>(cpu.reg(10));
         }
 
         trace_and_difftest();
+        SIM.check_save_point();
 
         if (sdb_state != SDBState::Running) break;
 
@@ -19,8 +19,10 @@
 #include <dlfcn.h>
 
 #include <iostream>
+#include <thread>
 
 #include "utils/disasm.hpp"
+#include "utils/spsc_queue.hpp"
 
 enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 
@@ -43,23 +45,155 @@ struct diff_context_t
 
 #ifdef CONFIG_DIFFTEST
 
-static void sync_regs_to_ref(uint32_t pc)
+// The architectural state of the DUT, as the REF gets it after a skipped device access.
+static void dut_context(diff_context_t& ctx, uint32_t pc)
 {
     auto& cpu = SIM.cpu();
 
-    diff_context_t ctx{};
+    ctx = {};
     for (int i = 0; i < 16; i++)
         ctx.gpr[i] = cpu.reg(i);
     for (int i = 0; i < 4096; i++)
     {
         if (cpu.is_csr_valid(i))
             ctx.csr[i] = cpu.csr(i);
-        else
-            ctx.csr[i] = 0;
     }
     ctx.pc = pc;
+}
+
+// GPRs before the instruction being compared. Once it commits, the DUT's base register
+// might already be overwritten (e.g. `lw a0, 0(a0)`), so device accesses are decoded with these.
+static word_t committed_gpr[16];
+
+static void sync_regs_to_ref(uint32_t pc)
+{
+    static diff_context_t ctx;
+    dut_context(ctx, pc);
     ref_difftest_regcpy(&ctx, DIFFTEST_TO_REF);
+    memcpy(committed_gpr, ctx.gpr, sizeof(committed_gpr));
+}
+
+static bool is_device_inst(word_t inst, word_t src1)
+{
+    bool is_store = BITS(inst, 6, 0) == 0b0100011;
+    bool is_load = BITS(inst, 6, 0) == 0b0000011;
+    word_t imm;
+    // Store
+    if (is_store)
+        imm = (SEXT(BITS(inst, 31, 25), 7) << 5) | BITS(inst, 11, 7);
+    else if (is_load)
+        imm = SEXT(BITS(inst, 31, 20), 12);
+    else
+        return false;
+
+    auto addr = src1 + imm;
+
+    // See if it is accessing devices.
+    return DUTMemory::in_device(addr);
+}
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+// Asynchronous difftest:
+//   The REF runs on its own thread and pushes one `commit_record` per instruction into
+//   `commit_queue`. `difftest_step` only pops and compares. When the REF is about to execute
+//   a load/store to a device, it pushes a `DeviceSkip` record instead and blocks on
+//   `sync_queue` until the DUT reaches the same instruction and sends its state back,
+//   which is what `sync_regs_to_ref` does in the synchronous mode. The REF decodes the
+//   access before executing it, so its decision is the one `difftest_step` follows.
+
+static constexpr uint32_t checked_csrs[] = {
+#define CSR_TABLE_ENTRY(name, idx) idx,
+    CSR_TABLE
+#undef CSR_TABLE_ENTRY
+};
+static constexpr int nr_checked_csrs = ARRLEN(checked_csrs);
+
+struct commit_record
+{
+    enum class Kind : uint8_t { Exec, DeviceSkip, Halt } kind;
+    // Exec/Halt: REF's pc after the instruction (dnpc). DeviceSkip: pc of the skipped instruction.
+    // DeviceSkip records only carry the pc, the state comes back through `sync_queue`.
+    word_t pc;
+    word_t gpr[16];
+    word_t csr[nr_checked_csrs];
+};
+
+static SPSCQueue<commit_record, 1024> commit_queue;
+static SPSCQueue<diff_context_t, 2> sync_queue;
+static std::atomic_bool ref_halted;
+static std::jthread ref_thread;
+
+static void pack_record(commit_record& rec, const diff_context_t& ctx)
+{
+    rec.pc = ctx.pc;
+    for (int i = 0; i < 16; i++)
+        rec.gpr[i] = ctx.gpr[i];
+    for (int i = 0; i < nr_checked_csrs; i++)
+        rec.csr[i] = ctx.csr[checked_csrs[i]];
+}
+
+static void unpack_record(diff_context_t& ctx, const commit_record& rec)
+{
+    ctx.pc = rec.pc;
+    for (int i = 0; i < 16; i++)
+        ctx.gpr[i] = rec.gpr[i];
+    for (int i = 0; i < nr_checked_csrs; i++)
+        ctx.csr[checked_csrs[i]] = rec.csr[i];
+}
+
+template <typename Q>
+static bool push_until(Q& q, const commit_record& rec, const std::stop_token& st)
+{
+    while (!q.push(rec))
+    {
+        if (st.stop_requested())
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+static void ref_worker(std::stop_token st)
+{
+    static diff_context_t ctx{};
+    commit_record rec{};
+    ref_difftest_regcpy(&ctx, DIFFTEST_TO_DUT);
+
+    while (!st.stop_requested())
+    {
+        word_t inst;
+        ref_difftest_memcpy(ctx.pc, &inst, sizeof(inst), DIFFTEST_TO_DUT);
+
+        if (is_device_inst(inst, ctx.gpr[BITS(inst, 19, 15)]))
+        {
+            rec.kind = commit_record::Kind::DeviceSkip;
+            rec.pc = ctx.pc;
+            if (!push_until(commit_queue, rec, st))
+                break;
+
+            while (!sync_queue.pop(ctx))
+            {
+                if (st.stop_requested())
+                    return;
+                std::this_thread::yield();
+            }
+            ref_difftest_regcpy(&ctx, DIFFTEST_TO_REF);
+            continue;
+        }
+
+        ref_difftest_exec(1);
+        ref_difftest_regcpy(&ctx, DIFFTEST_TO_DUT);
+
+        // NEMU stops at ebreak, don't keep stepping it.
+        bool halt = inst == 0x00100073;
+        rec.kind = halt ? commit_record::Kind::Halt : commit_record::Kind::Exec;
+        pack_record(rec, ctx);
+        if (!push_until(commit_queue, rec, st) || halt)
+            break;
+    }
+    ref_halted = true;
 }
+#endif
 
 void init_difftest(size_t img_size)
 {
@@ -98,6 +232,11 @@ void init_difftest(size_t img_size)
     // Initialize registers
     // Don't use cpu.pc() here, since pc is a binding in EXU, and might be invalid at the beginning.
     sync_regs_to_ref(RESET_VECTOR);
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+    Log("Asynchronous difftest: REF runs on a separate thread");
+    ref_thread = std::jthread(ref_worker);
+#endif
 }
 
 // After each `difftest_step`, ref's pc is updated to `dnpc`, but difftest_pc() is the
@@ -107,6 +246,62 @@ void init_difftest(size_t img_size)
 // saved ref's pc.
 static uint32_t expected_pc = RESET_VECTOR;
 
+// After a checkpoint is restored, the REF gets the DUT's memories and committed registers.
+// The pc of the next instruction is only known when it commits, so the registers are kept
+// in `resync_ctx` and handed over at the next `difftest_step`.
+// ATTENTION: SRAM lives inside the model and can not be copied. The REF keeps its own,
+//   unless `sram_image` has been filled by a fast-forward.
+static bool resync_pending = false;
+static diff_context_t resync_ctx;
+
+void difftest_resync()
+{
+    auto& cpu = SIM.cpu();
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+    if (ref_thread.joinable())
+    {
+        ref_thread.request_stop();
+        ref_thread.join();
+    }
+    commit_record rec;
+    static diff_context_t ctx;
+    while (commit_queue.pop(rec) || sync_queue.pop(ctx))
+        ;
+    ref_halted = false;
+#endif
+
+    Log("Resynchronizing REF with the restored DUT");
+    auto& mem = SIM.mem();
+    for (const auto& r : mem.regions)
+    {
+        if (r.size != 0)
+            ref_difftest_memcpy(r.base, r.host, r.size, DIFFTEST_TO_REF);
+    }
+    if (!mem.sram_image.empty())
+        ref_difftest_memcpy(CONFIG_SRAM_BASE, mem.sram_image.data(), mem.sram_image.size(), DIFFTEST_TO_REF);
+
+    resync_ctx = {};
+    for (int i = 0; i < 16; i++)
+        resync_ctx.gpr[i] = cpu.reg(i);
+    for (int i = 0; i < 4096; i++)
+    {
+        if (cpu.is_csr_valid(i))
+            resync_ctx.csr[i] = cpu.csr(i);
+    }
+    resync_pending = true;
+}
+
+static void finish_resync()
+{
+    resync_ctx.pc = SIM.cpu().difftest_pc();
+    ref_difftest_regcpy(&resync_ctx, DIFFTEST_TO_REF);
+    memcpy(committed_gpr, resync_ctx.gpr, sizeof(committed_gpr));
+    expected_pc = resync_ctx.pc;
+    resync_pending = false;
+    IFDEF(CONFIG_DIFFTEST_ASYNC, ref_thread = std::jthread(ref_worker));
+}
+
 static void check_regs(diff_context_t* ref)
 {
     auto& cpu = SIM.cpu();
@@ -144,45 +339,84 @@ static void check_regs(diff_context_t* ref)
     if (!match)
     {
         sdb_state = SDBState::Abort;
+        SIM.keep_trace();
         printf("Test failed after difftest_pc=" FMT_WORD ", difftest_inst=" FMT_WORD "\n",
                cpu.difftest_pc(), cpu.difftest_inst());
         cpu.dump();
     }
 }
 
-static bool is_accessing_device()
+#ifdef CONFIG_DIFFTEST_ASYNC
+static void difftest_abort(const char* reason)
 {
     auto& cpu = SIM.cpu();
-    auto inst = cpu.difftest_inst();
+    Log("%s", reason);
+    sdb_state = SDBState::Abort;
+    SIM.keep_trace();
+    printf("Test failed after difftest_pc=" FMT_WORD ", difftest_inst=" FMT_WORD "\n",
+           cpu.difftest_pc(), cpu.difftest_inst());
+    cpu.dump();
+}
 
-    bool is_store = BITS(inst, 6, 0) == 0b0100011;
-    bool is_load = BITS(inst, 6, 0) == 0b0000011;
-    word_t imm;
-    // Store
-    if (is_store)
-        imm = (SEXT(BITS(inst, 31, 25), 7) << 5) | BITS(inst, 11, 7);
-    else if (is_load)
-        imm = SEXT(BITS(inst, 31, 20), 12);
-    else
-        return false;
+void difftest_step()
+{
+    if (resync_pending) [[unlikely]]
+        finish_resync();
 
-    auto rs1 = BITS(inst, 19, 15);
-    auto src1 = cpu.reg(rs1);
+    auto& cpu = SIM.cpu();
+    auto difftest_pc = cpu.difftest_pc();
 
-    auto addr = src1 + imm;
+    IFDEF(CONFIG_DIFFTEST_TRACE,
+          fprintf(stderr, "DIFF_STEP, 0x%x: %s\n", difftest_pc,
+              rv32_disasm(difftest_pc, cpu.difftest_inst()).c_str())
+    );
 
-    // See if it is accessing devices.
-    if (DUTMemory::in_device(addr))
+    commit_record rec;
+    while (!commit_queue.pop(rec))
     {
-        // printf("Accessing device at addr: " FMT_WORD ", inst: 0x%x\n", addr, inst);
-        return true;
+        if (ref_halted)
+        {
+            // The last record might be pushed just before `ref_halted` is set.
+            if (commit_queue.pop(rec))
+                break;
+            difftest_abort("REF has halted, but DUT is still running");
+            return;
+        }
+        std::this_thread::yield();
     }
 
-    return false;
-}
+    if (rec.kind == commit_record::Kind::DeviceSkip)
+    {
+        if (rec.pc != difftest_pc)
+        {
+            Log("REF skipped a device access at " FMT_WORD, rec.pc);
+            difftest_abort("Device access mismatch");
+            return;
+        }
 
+        // See the synchronous version for `difftest_pc + 4`.
+        auto dnpc = difftest_pc + 4;
+        static diff_context_t ctx;
+        dut_context(ctx, dnpc);
+        while (!sync_queue.push(ctx))
+            std::this_thread::yield();
+        expected_pc = dnpc;
+        return;
+    }
+
+    static diff_context_t ref_r{};
+    unpack_record(ref_r, rec);
+    check_regs(&ref_r);
+
+    // Update pc
+    expected_pc = ref_r.pc;
+}
+#else
 void difftest_step()
 {
+    if (resync_pending) [[unlikely]]
+        finish_resync();
+
     auto difftest_pc = SIM.cpu().difftest_pc();
 
     IFDEF(CONFIG_DIFFTEST_TRACE,
@@ -190,7 +424,8 @@ void difftest_step()
               rv32_disasm(difftest_pc, SIM.cpu().difftest_inst()).c_str())
     );
 
-    if (is_accessing_device())
+    auto inst = SIM.cpu().difftest_inst();
+    if (is_device_inst(inst, committed_gpr[BITS(inst, 19, 15)]))
     {
         // ATTENTION: difftest_pc + 4
         //   `is_accessing_device` can only be true in store or load, thus the dnpc
@@ -207,14 +442,19 @@ void difftest_step()
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
     check_regs(&ref_r);
+    memcpy(committed_gpr, ref_r.gpr, sizeof(committed_gpr));
 
     // Update pc
     expected_pc = ref_r.pc;
 }
+#endif
 #else
 void init_difftest()
 {
 }
+void difftest_resync()
+{
+}
 void difftest_step()
 {
 }
@@ -14,21 +14,32 @@
  ***************************************************************************************/
 
 #include <elf.h>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "sdb.hpp"
 
-typedef struct ftrace_sym_t
+// Function symbols sorted by address. Names live in an interned string pool
+// and are referenced by offset.
+struct ftrace_sym_t
 {
     uint32_t addr;
     uint32_t size;
-    char name[128];
-} ftrace_sym_t;
+    uint32_t name;
+    int parent; // innermost earlier symbol whose range contains this one, or -1
+};
 
-#define FTRACE_TABLE_MAXSIZE 8192
-ftrace_sym_t ftrace_table[FTRACE_TABLE_MAXSIZE];
-size_t ftrace_size = 0;
+static std::vector<ftrace_sym_t> ftrace_table;
+static std::string pool;
+static std::unordered_map<std::string, uint32_t> interned;
+// Address of the first symbol with each name. Kept separately, since
+// ftrace_table_finish() drops aliases that share an address.
+static std::unordered_map<std::string, uint32_t> name_addr;
 
 static void* read_chunk(FILE* fp, size_t off, size_t sz)
 {
@@ -48,42 +59,184 @@ static void free_chunk(void* buf)
     free(buf);
 }
 
-void ftrace_table_push(uint32_t addr, uint32_t size, const char* name)
+static uint32_t intern(const char* name)
 {
-    Assert(ftrace_size < FTRACE_TABLE_MAXSIZE, "ftrace table is full");
-    ftrace_table[ftrace_size].addr = addr;
-    ftrace_table[ftrace_size].size = size;
+    auto [it, inserted] = interned.try_emplace(name, static_cast<uint32_t>(pool.size()));
+    if (inserted)
+        pool.append(name, strlen(name) + 1);
+    return it->second;
+}
 
+void ftrace_table_push(uint32_t addr, uint32_t size, const char* name)
+{
     Assert(name != nullptr, "name is null");
-    Assert(strlen(name) < sizeof(ftrace_table[ftrace_size].name), "name is too long");
-
-    strncpy(ftrace_table[ftrace_size].name, name, sizeof(ftrace_table[ftrace_size].name));
-    ftrace_size++;
+    ftrace_table.push_back({addr, size, intern(name), -1});
+    name_addr.try_emplace(name, addr);
     // Log("ftrace: %s @ 0x%x", name, addr);
 }
 
-const char* ftrace_search(uint32_t pc, uint32_t* entry_addr)
+static bool sym_contains(const ftrace_sym_t& sym, uint32_t pc)
 {
-    for (size_t i = 0; i < ftrace_size; i++)
+    return pc >= sym.addr && static_cast<uint64_t>(pc) < static_cast<uint64_t>(sym.addr) + sym.size;
+}
+
+// Sort by address and drop symbols with the same address (e.g. from both
+// SHT_SYMTAB and SHT_DYNSYM, or aliases, which are still found by name).
+// Symbols may still nest (local labels, aliases with a smaller size), so
+// link each one to its enclosing symbol.
+static void ftrace_table_finish()
+{
+    std::sort(ftrace_table.begin(), ftrace_table.end(), [](const auto& x, const auto& y)
     {
-        if (pc >= ftrace_table[i].addr && pc < ftrace_table[i].addr + ftrace_table[i].size)
-        {
-            if (entry_addr)
-                *entry_addr = ftrace_table[i].addr;
-            return ftrace_table[i].name;
-        }
+        // Larger first, so that it is kept when dropping duplicates.
+        return x.addr != y.addr ? x.addr < y.addr : x.size > y.size;
+    });
+    auto last = std::unique(ftrace_table.begin(), ftrace_table.end(), [](const auto& x, const auto& y)
+    {
+        return x.addr == y.addr;
+    });
+    ftrace_table.erase(last, ftrace_table.end());
+    interned.clear();
+
+    // Walk the parent chain of the previous symbol, which is the stack of
+    // ranges still open at this address.
+    for (int i = 0; i < static_cast<int>(ftrace_table.size()); i++)
+    {
+        int p = i - 1;
+        while (p >= 0 && !sym_contains(ftrace_table[p], ftrace_table[i].addr))
+            p = ftrace_table[p].parent;
+        ftrace_table[i].parent = p;
     }
-    return nullptr;
+}
+
+static int ftrace_index(uint32_t pc)
+{
+    static size_t last_hit = 0;
+    // The cached symbol is only the answer if no nested symbol starts before pc.
+    if (last_hit < ftrace_table.size() && sym_contains(ftrace_table[last_hit], pc) &&
+        (last_hit + 1 == ftrace_table.size() || pc < ftrace_table[last_hit + 1].addr))
+        return static_cast<int>(last_hit);
+
+    // Find the last symbol with addr <= pc
+    auto it = std::upper_bound(ftrace_table.begin(), ftrace_table.end(), pc, [](uint32_t v, const auto& sym)
+    {
+        return v < sym.addr;
+    });
+    // pc may be past the end of that symbol but still inside an enclosing one.
+    int i = static_cast<int>(it - ftrace_table.begin()) - 1;
+    while (i >= 0 && !sym_contains(ftrace_table[i], pc))
+        i = ftrace_table[i].parent;
+    if (i >= 0)
+        last_hit = i;
+    return i;
+}
+
+const char* ftrace_search(uint32_t pc, uint32_t* entry_addr)
+{
+    int i = ftrace_index(pc);
+    if (i < 0)
+        return nullptr;
+    if (entry_addr)
+        *entry_addr = ftrace_table[i].addr;
+    return pool.c_str() + ftrace_table[i].name;
 }
 
 word_t ftrace_get_address_of(const char* name)
 {
-    for (size_t i = 0; i < ftrace_size; i++)
+    auto it = name_addr.find(name);
+    return it == name_addr.end() ? 0 : it->second;
+}
+
+// Shadow call stack.
+// Each frame records the instruction count at entry and the instructions
+// spent in its callees, so inclusive/exclusive counts are accumulated on
+// return without any per-instruction work.
+struct ftrace_prof_t
+{
+    uint64_t calls;
+    uint64_t incl;
+    uint64_t excl;
+    uint32_t active; // frames of this function on the stack, to handle recursion
+};
+
+struct ftrace_frame_t
+{
+    int sym;
+    uint64_t enter;
+    uint64_t child;
+};
+
+static std::vector<ftrace_prof_t> prof;
+static std::vector<ftrace_frame_t> call_stack;
+
+int ftrace_depth()
+{
+    return static_cast<int>(call_stack.size());
+}
+
+static void ftrace_pop(uint64_t icount)
+{
+    auto f = call_stack.back();
+    call_stack.pop_back();
+    auto incl = icount - f.enter;
+    auto& p = prof[f.sym];
+    p.excl += incl - f.child;
+    if (--p.active == 0)
+        p.incl += incl;
+    if (!call_stack.empty())
+        call_stack.back().child += incl;
+}
+
+void ftrace_call(uint32_t entry, bool is_tail, uint64_t icount)
+{
+    int i = ftrace_index(entry);
+    if (i < 0)
+        return;
+    // A tail call replaces the caller's frame.
+    if (is_tail && !call_stack.empty())
+        ftrace_pop(icount);
+    call_stack.push_back({i, icount, 0});
+    prof[i].calls++;
+    prof[i].active++;
+}
+
+void ftrace_ret(uint32_t pc, uint64_t icount)
+{
+    int i = ftrace_index(pc);
+    auto it = std::find_if(call_stack.rbegin(), call_stack.rend(), [i](const auto& f) { return f.sym == i; });
+    // Not on the stack, e.g. returning from the function that was running before ftrace started.
+    if (it == call_stack.rend())
+        return;
+    auto d = call_stack.rend() - it - 1;
+    while (static_cast<long>(call_stack.size()) > d)
+        ftrace_pop(icount);
+}
+
+void ftrace_profile_display(uint64_t icount)
+{
+    constexpr int top = 20;
+    if (prof.empty() || icount == 0)
+        return;
+    while (!call_stack.empty())
+        ftrace_pop(icount);
+
+    std::vector<int> order;
+    for (size_t i = 0; i < prof.size(); i++)
+    {
+        if (prof[i].calls > 0)
+            order.push_back(static_cast<int>(i));
+    }
+    std::sort(order.begin(), order.end(), [](int x, int y) { return prof[x].excl > prof[y].excl; });
+
+    printf("ftrace profile (instructions, top %d by self):\n", top);
+    printf("%12s %14s %7s %14s %7s  %s\n", "calls", "self", "self%", "total", "total%", "function");
+    for (int k = 0; k < static_cast<int>(order.size()) && k < top; k++)
     {
-        if (strcmp(ftrace_table[i].name, name) == 0)
-            return ftrace_table[i].addr;
+        auto& p = prof[order[k]];
+        printf("%12" PRIu64 " %14" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%%  %s\n",
+               p.calls, p.excl, 100.0 * p.excl / icount, p.incl, 100.0 * p.incl / icount,
+               pool.c_str() + ftrace_table[order[k]].name);
     }
-    return 0;
 }
 
 void init_ftrace(const char* file)
@@ -156,5 +309,8 @@ void init_ftrace(const char* file)
     free_chunk(shdrs);
     fclose(fp);
 
-    Log("ftrace: loaded %zu function symbols", ftrace_size);
+    ftrace_table_finish();
+    prof.assign(ftrace_table.size(), {});
+
+    Log("ftrace: loaded %zu function symbols", ftrace_table.size());
 }
@@ -16,6 +16,7 @@
 #include <regex.h>
 #include <cstdlib>
 #include <climits>
+#include <vector>
 
 #include "dut_proxy.hpp"
 #include "sdb.hpp"
@@ -139,7 +140,7 @@ typedef struct token
     char* str;
 } Token;
 
-static Token* tokens __attribute__((used)) = {};
+static Token* tokens __attribute__((used)) = nullptr;
 static int nr_token __attribute__((used)) = 0;
 static size_t token_buf_size = 128;
 
@@ -352,7 +353,8 @@ int find_dominant_operator(int p, int q, bool* success)
         if (is_binary_token(t) || is_unary_token(t))
         {
             int prec = get_precedence(t);
-            if (prec <= min_prec)
+            // Binary operators are left-associative, unary ones right-associative.
+            if (prec < min_prec || (prec == min_prec && !is_unary_token(t)))
             {
                 min_prec = prec;
                 idx = i;
@@ -370,16 +372,42 @@ int find_dominant_operator(int p, int q, bool* success)
     return idx;
 }
 
-static word_t eval(int p, int q, bool* success)
+/* Expressions are compiled into postfix code once, so that watchpoints
+ * don't go through the tokenizer and the parser on every retired instruction.
+ */
+struct ExprOp
 {
-    if (!success)
-        return 0;
+    int type; // TK_NUM, TK_REG or an operator
+    union
+    {
+        word_t imm;
+        const word_t* reg;
+    };
+};
 
-    if (p > q)
+struct Expr
+{
+    std::vector<ExprOp> code;
+    int depth = 0; // stack depth after the last op
+    // Operand stack for expr_eval, sized by the deepest point of `code`.
+    mutable std::vector<word_t> stack;
+
+    void emit(const ExprOp& op)
     {
-        *success = false;
-        return 0;
+        code.emplace_back(op);
+        if (op.type == TK_NUM || op.type == TK_REG)
+            depth++;
+        else if (is_binary_token(op.type))
+            depth--;
+        if (depth > static_cast<int>(stack.size()))
+            stack.resize(depth);
     }
+};
+
+static bool compile(Expr* ex, int p, int q)
+{
+    if (p > q)
+        return false;
 
     if (p == q)
     {
@@ -391,30 +419,29 @@ static word_t eval(int p, int q, bool* success)
             word_t ret = strtol(tokens[p].str, &endptr, base16 ? 16 : 10);
             if (tokens[p].str == endptr)
             {
-                Log("eval: Bad number: %s", tokens[p].str);
-                *success = false;
-                return 0;
+                Log("compile: Bad number: %s", tokens[p].str);
+                return false;
             }
-            return ret;
+            ex->emit({.type = TK_NUM, .imm = ret});
+            return true;
         }
 
         if (tokens[p].type == TK_REG)
         {
-            word_t res = isa_reg_str2val(tokens[p].str + 1, success);
-            if (*success)
-                return res;
-
-            res = isa_csr_str2val(tokens[p].str + 1, success);
-
-            if (!*success)
-                Log("eval: Bad reg/csr: %s", tokens[p].str);
-
-            return res;
+            auto reg = isa_reg_str2ptr(tokens[p].str + 1);
+            if (reg == nullptr)
+                reg = isa_csr_str2ptr(tokens[p].str + 1);
+            if (reg == nullptr)
+            {
+                Log("compile: Bad reg/csr: %s", tokens[p].str);
+                return false;
+            }
+            ex->emit({.type = TK_REG, .reg = reg});
+            return true;
         }
 
-        *success = false;
-        Log("eval: unexpected token.");
-        return 0;
+        Log("compile: unexpected token.");
+        return false;
     }
 
     bool invalid_expr = false;
@@ -423,172 +450,183 @@ static word_t eval(int p, int q, bool* success)
         /* The expression is surrounded by a matched pair of parentheses.
          * If that is the case, just throw away the parentheses.
          */
-        return eval(p + 1, q - 1, success);
+        return compile(ex, p + 1, q - 1);
     }
 
     if (invalid_expr)
     {
-        *success = false;
-        Log("eval: parentheses mismatch.");
-        return 0;
+        Log("compile: parentheses mismatch.");
+        return false;
     }
 
-    int op = find_dominant_operator(p, q, success);
-    if (!*success)
-        return 0;
+    bool success = true;
+    int op = find_dominant_operator(p, q, &success);
+    if (!success)
+        return false;
 
     if (is_unary_token(tokens[op].type))
     {
-        word_t val = eval(op + 1, q, success);
-        if (!*success)
-            return 0;
-        switch (tokens[op].type)
+        if (!compile(ex, op + 1, q))
+            return false;
+        ex->emit({.type = tokens[op].type});
+        return true;
+    }
+
+    Assert(is_binary_token(tokens[op].type), "Bad find_dominant_operator");
+
+    if (!compile(ex, p, op - 1) || !compile(ex, op + 1, q))
+        return false;
+    ex->emit({.type = tokens[op].type});
+    return true;
+}
+
+void expr_free(Expr* ex)
+{
+    delete ex;
+}
+
+Expr* expr_compile(char* e)
+{
+    Assert(e != nullptr, "Bad arguments.");
+
+    if (!make_token(e))
+    {
+        free_token();
+        return nullptr;
+    }
+
+    match_unary_tokens();
+
+    auto ex = new Expr;
+    bool ok = compile(ex, 0, nr_token - 1);
+    free_token();
+
+    if (!ok)
+    {
+        delete ex;
+        return nullptr;
+    }
+    return ex;
+}
+
+word_t expr_eval(const Expr* ex, bool* success)
+{
+    auto stack = ex->stack.data();
+    int sp = 0;
+
+    for (const auto& op : ex->code)
+    {
+        switch (op.type)
         {
+        case TK_NUM:
+            stack[sp++] = op.imm;
+            continue;
+        case TK_REG:
+            stack[sp++] = *op.reg;
+            continue;
         case TK_UNARY_NOT:
-            return ~val;
+            stack[sp - 1] = ~stack[sp - 1];
+            continue;
         case TK_UNARY_LNOT:
-            return (word_t)(!val);
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
         case TK_UNARY_MINUS:
-            return static_cast<uint32_t>(-static_cast<int64_t>(val));
+            stack[sp - 1] = static_cast<uint32_t>(-static_cast<int64_t>(stack[sp - 1]));
+            continue;
         case TK_UNARY_DEREF:
             {
-                if (val % 4 != 0)
+                word_t addr = stack[sp - 1];
+                if (addr % 4 != 0)
                 {
-                    Log("dereference unaligned, addr: 0x%x", val);
+                    Log("dereference unaligned, addr: 0x%x", addr);
                     *success = false;
                     return 0;
                 }
 
-                if (!DUTMemory::in_sim_mem(val))
+                if (!DUTMemory::in_sim_mem(addr))
                 {
-                    Log("dereference out of bound, addr: 0x%x", val);
+                    Log("dereference out of bound, addr: 0x%x", addr);
                     *success = false;
                     return 0;
                 }
 
-                return SIM.mem().read<uint32_t>(val);
+                stack[sp - 1] = SIM.mem().read<uint32_t>(addr);
+                continue;
             }
         default:
-            panic("unexpected unary operator");
+            break;
         }
-    }
-
-    Assert(is_binary_token(tokens[op].type), "Bad find_dominant_operator");
-
-    word_t val1 = eval(p, op - 1, success);
-
-    if (!*success)
-        return 0;
 
-    word_t val2 = eval(op + 1, q, success);
-
-    if (!*success)
-        return 0;
-
-    switch (tokens[op].type)
-    {
+        word_t val2 = stack[--sp];
+        word_t val1 = stack[sp - 1];
+        word_t res;
+        switch (op.type)
+        {
 #define MAKE_OP(TOK, OP)                                                       \
   case TOK:                                                                    \
-    return val1 OP val2;
-    MAKE_OP(TK_EQ, ==)
-    MAKE_OP(TK_NE, !=)
-    MAKE_OP(TK_LE, <=)
-    MAKE_OP(TK_LT, <)
-    MAKE_OP(TK_GE, >=)
-    MAKE_OP(TK_GT, >)
-    MAKE_OP(TK_ADD, +)
-    MAKE_OP(TK_SUB, -)
-    MAKE_OP(TK_MUL, *)
-    MAKE_OP(TK_AND, &)
-    MAKE_OP(TK_OR, |)
-    MAKE_OP(TK_XOR, ^)
-    MAKE_OP(TK_SHL, <<)
-    MAKE_OP(TK_LSHR, >>)
-    MAKE_OP(TK_LAND, &&)
-    MAKE_OP(TK_LOR, ||)
+    res = val1 OP val2;                                                        \
+    break;
+        MAKE_OP(TK_EQ, ==)
+        MAKE_OP(TK_NE, !=)
+        MAKE_OP(TK_LE, <=)
+        MAKE_OP(TK_LT, <)
+        MAKE_OP(TK_GE, >=)
+        MAKE_OP(TK_GT, >)
+        MAKE_OP(TK_ADD, +)
+        MAKE_OP(TK_SUB, -)
+        MAKE_OP(TK_MUL, *)
+        MAKE_OP(TK_AND, &)
+        MAKE_OP(TK_OR, |)
+        MAKE_OP(TK_XOR, ^)
+        MAKE_OP(TK_SHL, <<)
+        MAKE_OP(TK_LSHR, >>)
+        MAKE_OP(TK_LAND, &&)
+        MAKE_OP(TK_LOR, ||)
 #undef MAKE_OP
-    case TK_ASHR:
-        return static_cast<uint32_t>(static_cast<int32_t>(val1) >> val2);
-    case TK_DIV:
-        if (val2 == 0)
-        {
-            *success = false;
-            return 0;
-        }
-        return val1 / val2;
-    case TK_REM:
-        if (val2 == 0)
-        {
-            *success = false;
-            return 0;
+        case TK_ASHR:
+            res = static_cast<uint32_t>(static_cast<int32_t>(val1) >> val2);
+            break;
+        case TK_DIV:
+        case TK_REM:
+            if (val2 == 0)
+            {
+                *success = false;
+                return 0;
+            }
+            res = op.type == TK_DIV ? val1 / val2 : val1 % val2;
+            break;
+        default:
+            panic("unexpected operator");
         }
-        return val1 % val2;
-    default:
-        panic("unexpected binary operator");
+        stack[sp - 1] = res;
     }
-    return 0;
+
+    *success = true;
+    return stack[0];
 }
 
 word_t expr(char* e, bool* success)
 {
     Assert(e != nullptr && success != nullptr, "Bad arguments.");
 
-    if (!make_token(e))
+    auto ex = expr_compile(e);
+    if (ex == nullptr)
     {
         *success = false;
-        free_token();
         return 0;
     }
 
-    match_unary_tokens();
-
-    *success = true;
-
-    word_t res = eval(0, nr_token - 1, success);
-    free_token();
+    word_t res = expr_eval(ex, success);
+    expr_free(ex);
 
     return res;
 }
 
-bool syntax_check_impl(int p, int q)
-{
-    if (p > q)
-        return false;
-
-    if (p == q)
-        return true;
-
-    bool invalid_expr = false;
-    if (check_parentheses(p, q, &invalid_expr))
-        return syntax_check_impl(p + 1, q - 1);
-
-    if (invalid_expr)
-        return false;
-
-    bool success = true;
-    int op = find_dominant_operator(p, q, &success);
-    if (!success)
-        return false;
-
-    if (is_unary_token(tokens[op].type))
-        return syntax_check_impl(op + 1, q);
-
-    return syntax_check_impl(p, op - 1) && syntax_check_impl(op + 1, q);
-}
-
 bool syntax_check(char* e)
 {
-    Assert(e != nullptr, "Bad arguments.");
-
-    if (!make_token(e))
-    {
-        free_token();
+    auto ex = expr_compile(e);
+    if (ex == nullptr)
         return false;
-    }
-
-    match_unary_tokens();
-    bool res = syntax_check_impl(0, nr_token - 1);
-    free_token();
-
-    return res;
+    expr_free(ex);
+    return true;
 }
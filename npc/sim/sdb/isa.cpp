@@ -28,7 +28,7 @@ void isa_csr_display()
     SIM.cpu().dump_csrs(stdout);
 }
 
-word_t isa_csr_str2val(const char* s, bool* success)
+const word_t* isa_csr_str2ptr(const char* s)
 {
     auto& cpu = SIM.cpu();
     for (int i = 0; i < 4096; i++)
@@ -37,49 +37,47 @@ word_t isa_csr_str2val(const char* s, bool* success)
             continue;
 
         if (strcmp(s, csr_names[i]) == 0)
-        {
-            *success = true;
-            return cpu.csr(i);
-        }
+            return cpu.csr_ptr(i);
     }
-    *success = false;
-    return 0;
+    return nullptr;
 }
 
-word_t isa_reg_str2val(const char* s, bool* success)
+word_t isa_csr_str2val(const char* s, bool* success)
+{
+    auto p = isa_csr_str2ptr(s);
+    *success = p != nullptr;
+    return p ? *p : 0;
+}
+
+const word_t* isa_reg_str2ptr(const char* s)
 {
     auto& cpu = SIM.cpu();
 
     if (strcmp(s, "pc") == 0)
-    {
-        *success = true;
-        return cpu.exu_pc();
-    }
+        return cpu.exu_pc_ptr();
 
     if (s[0] == 'x' || s[0] == 'X')
     {
         char* endptr;
         word_t idx = strtol(s + 1, &endptr, 10);
         if (endptr == s + 1 || idx >= 16)
-        {
-            *success = false;
-            return 0;
-        }
-
-        *success = true;
-        return cpu.reg(idx);
+            return nullptr;
+        return cpu.reg_ptr(idx);
     }
 
     for (int i = 0; i < 16; i++)
     {
         if (strcmp(s, gpr_names[i]) == 0)
-        {
-            *success = true;
-            return cpu.reg(i);
-        }
+            return cpu.reg_ptr(i);
     }
-    *success = false;
-    return 0;
+    return nullptr;
+}
+
+word_t isa_reg_str2val(const char* s, bool* success)
+{
+    auto p = isa_reg_str2ptr(s);
+    *success = p != nullptr;
+    return p ? *p : 0;
 }
 
 static int ftrace_dump(int rd, int rs1, word_t imm, char* buf, size_t buf_size)
@@ -123,8 +121,9 @@ static int ftrace_dump(int rd, int rs1, word_t imm, char* buf, size_t buf_size)
         if (dnpc != entry_addr)
             return -1;
 
-        snprintf(buf, buf_size, FMT_WORD ": %s [%s@" FMT_WORD "]",
-                 pc, (rd == 1 ? "call" : "tail"), callee, entry_addr);
+        snprintf(buf, buf_size, FMT_WORD ": %*s%s [%s@" FMT_WORD "]",
+                 pc, ftrace_depth() * 2, "", (rd == 1 ? "call" : "tail"), callee, entry_addr);
+        ftrace_call(entry_addr, rd != 1, SIM.cpu().inst_count());
     }
     else if (is_ret)
     {
@@ -134,7 +133,8 @@ static int ftrace_dump(int rd, int rs1, word_t imm, char* buf, size_t buf_size)
             Log("ftrace: Unknown function at " FMT_WORD, pc);
             return -1;
         }
-        snprintf(buf, buf_size, FMT_WORD ": ret [%s]", pc, callee);
+        ftrace_ret(pc, SIM.cpu().inst_count());
+        snprintf(buf, buf_size, FMT_WORD ": %*sret [%s]", pc, ftrace_depth() * 2, "", callee);
     }
     else
     {
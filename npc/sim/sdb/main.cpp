@@ -21,6 +21,7 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include <algorithm>
 #include <csignal>
 #include <iostream>
 
@@ -184,6 +185,53 @@ static int cmd_w(char* args)
     return 0;
 }
 
+// wm ADDR [LEN]
+static int cmd_wm(char* args)
+{
+    if (args == nullptr)
+    {
+        printf("wm: Expected an address.\n");
+        return 0;
+    }
+
+    char* endptr;
+    word_t addr = strtoul(args, &endptr, 16);
+    if (endptr == args)
+    {
+        printf("wm: Expected a hexadecimal address.\n");
+        return 0;
+    }
+    char* len_str = endptr;
+    word_t len = strtoul(len_str, &endptr, 0);
+    if (endptr == len_str)
+        len = 4;
+    if (len == 0)
+    {
+        printf("wm: Bad length.\n");
+        return 0;
+    }
+    if (static_cast<uint64_t>(addr) + len > UINT32_MAX)
+    {
+        printf("wm: [" FMT_WORD ", +0x%x) wraps around the address space.\n", addr, len);
+        return 0;
+    }
+    // Only writes through DUTMemory are seen, the SRAM is inside the model.
+    uint32_t sram_lo = std::max<uint32_t>(addr, CONFIG_SRAM_BASE);
+    uint32_t sram_hi = std::min<uint32_t>(addr + len, CONFIG_SRAM_BASE + CONFIG_SRAM_SIZE);
+    if (sram_lo < sram_hi)
+    {
+        if (sram_hi - sram_lo == len)
+        {
+            printf("wm: Writes to SRAM are not visible to memory watchpoints.\n");
+            return 0;
+        }
+        printf("wm: Warning: Writes to the SRAM part [" FMT_WORD ", " FMT_WORD ") are not seen.\n", sram_lo, sram_hi);
+    }
+
+    wp_create_mem(addr, len);
+    return 0;
+}
+
 // d [N]
 static int cmd_d(char* args)
 {
@@ -240,6 +288,38 @@ static int cmd_b(char* args)
     return 0;
 }
 
+// save FILE
+static int cmd_save(char* args)
+{
+    if (args == nullptr)
+    {
+        printf("save: Expected a file name.\n");
+        return 0;
+    }
+
+    SIM.save_checkpoint(args);
+    return 0;
+}
+
+// load FILE
+static int cmd_load(char* args)
+{
+    if (args == nullptr)
+    {
+        printf("load: Expected a file name.\n");
+        return 0;
+    }
+
+    if (!SIM.restore_checkpoint(args))
+        return 0;
+
+    IFDEF(CONFIG_DIFFTEST, difftest_resync());
+    // The checkpoint might be taken before the program ends.
+    if (sdb_state == SDBState::End || sdb_state == SDBState::Abort)
+        sdb_state = SDBState::Stop;
+    return 0;
+}
+
 static int cmd_help(char* args);
 
 static struct
@@ -260,8 +340,11 @@ static struct
     {"info", "Print register status(r) or watchpoint information(w).", cmd_info},
     {"x", "Display N consecutive 4-byte words in hexadecimal at given address.", cmd_x},
     {"p", "Evaluate the expression.", cmd_p},
+    {"save", "Save a checkpoint of the simulation to FILE.", cmd_save},
+    {"load", "Restore the simulation from the checkpoint FILE.", cmd_load},
 #ifdef CONFIG_WP_BP
     {"w", "Pause execution when the value of the expression changes.", cmd_w},
+    {"wm", "Pause execution when memory [ADDR, ADDR + LEN) is written. LEN defaults to 4. SRAM writes are not seen.", cmd_wm},
     {"b", "Set a breakpoint at the given address/function.", cmd_b},
     {"d", "Delete the watchpoint/breakpoint with index N.", cmd_d},
 #endif
@@ -366,6 +449,8 @@ int is_exit_status_bad()
 static char* elf_file = nullptr;
 static char* img_file = nullptr;
 static char* statistics_file = nullptr;
+static char* restore_file = nullptr;
+static char* fast_forward = nullptr;
 
 static int parse_args(int argc, char* argv[])
 {
@@ -374,10 +459,17 @@ static int parse_args(int argc, char* argv[])
         {"elf", required_argument, nullptr, 'e'},
         {"help", no_argument, nullptr, 'h'},
         {"statistics", no_argument, nullptr, 's'},
+        {"save-at", required_argument, nullptr, 'S'},
+        {"restore", required_argument, nullptr, 'R'},
+        {"fast-forward", required_argument, nullptr, 'F'},
+        {"trace-start", required_argument, nullptr, 'T'},
+        {"trace-stop", required_argument, nullptr, 'P'},
+        {"trace-window", required_argument, nullptr, 'W'},
+        {"perf-interval", required_argument, nullptr, 'I'},
         {nullptr, 0, nullptr, 0},
     };
     int o;
-    while ((o = getopt_long(argc, argv, "-bhe:s:", table, nullptr)) != -1)
+    while ((o = getopt_long(argc, argv, "-bhe:s:S:R:F:T:P:W:I:", table, nullptr)) != -1)
     {
         switch (o)
         {
@@ -390,6 +482,37 @@ static int parse_args(int argc, char* argv[])
         case 's':
             statistics_file = optarg;
             break;
+        case 'S':
+            if (!SIM.set_save_point(optarg))
+            {
+                printf("Bad --save-at '%s', expected CYCLES:FILE or pc=ADDR:FILE\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'R':
+            restore_file = optarg;
+            break;
+        case 'F':
+            fast_forward = optarg;
+            break;
+        case 'T':
+        case 'P':
+            if (!(o == 'T' ? SIM.set_trace_start(optarg) : SIM.set_trace_stop(optarg)))
+            {
+                printf("Bad trigger '%s', expected CYCLES or pc=ADDR\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'W':
+            SIM.set_trace_window(strtoull(optarg, nullptr, 0));
+            break;
+        case 'I':
+            if (!SIM.set_perf_interval(optarg))
+            {
+                printf("Bad --perf-interval '%s', expected CYCLES or CYCLES:FILE\n", optarg);
+                exit(-1);
+            }
+            break;
         case 1:
             img_file = optarg;
             return 0;
@@ -398,6 +521,16 @@ static int parse_args(int argc, char* argv[])
             printf("\t-b,--batch                      run with batch mode\n");
             printf("\t-e,--elf=ELF_FILE               load symbols for ftrace.\n");
             printf("\t-s,--statistics=STATISTIC_FILE  Save statistics to file.\n");
+            printf("\t-S,--save-at=CYCLES:FILE        Save a checkpoint after CYCLES cycles.\n");
+            printf("\t   --save-at=pc=ADDR:FILE       Save a checkpoint once ADDR commits.\n");
+            printf("\t-R,--restore=FILE               Start from a checkpoint.\n");
+            printf("\t-F,--fast-forward=N|pc=ADDR     Run the first N instructions (or up to ADDR) in NEMU.\n");
+            printf("\t-T,--trace-start=CYCLES|pc=ADDR Start the waveform there.\n");
+            printf("\t-P,--trace-stop=CYCLES|pc=ADDR  Stop the waveform there.\n");
+            printf("\t-W,--trace-window=CYCLES        Only keep the last CYCLES to 2*CYCLES cycles of waveform,\n");
+            printf("\t                                and only if the run fails or --trace-stop fires.\n");
+            printf("\t-I,--perf-interval=CYCLES[:FILE] Write perf counter deltas every CYCLES cycles to FILE\n");
+            printf("\t                                (default: perf.csv).\n");
             printf("\n");
             exit(0);
         }
@@ -447,11 +580,20 @@ int main(int argc, char* argv[])
     SIM.init_sim(&DUT, img_file, statistics_file);
     SIM.reset(10);
 
+    if (restore_file && !SIM.restore_checkpoint(restore_file))
+        return -1;
+    if (fast_forward && !SIM.fast_forward(fast_forward))
+        return -1;
+
     IFDEF(CONFIG_DIFFTEST, init_difftest(SIM.mem().inst_memory_size));
+    if (restore_file || fast_forward)
+        IFDEF(CONFIG_DIFFTEST, difftest_resync());
 
     if (elf_file)
     IFDEF(CONFIG_FTRACE, init_ftrace(elf_file));
 
+    SIM.start_perf_samples();
+
     sdb_mainloop();
 
     SIM.cleanup();
@@ -34,18 +34,25 @@ void cpu_exec(uint64_t n);
 // Difftest
 void difftest_step();
 void init_difftest(size_t img_size);
+void difftest_resync();
 
 // ISA
 void isa_reg_display();
 void isa_csr_display();
 word_t isa_reg_str2val(const char* s, bool* success);
 word_t isa_csr_str2val(const char* s, bool* success);
+const word_t* isa_reg_str2ptr(const char* s);
+const word_t* isa_csr_str2ptr(const char* s);
 int isa_ftrace_dump(char* buf, size_t buf_size);
 
 // Expr
 void init_regex();
 bool syntax_check(char* e);
 word_t expr(char* e, bool* success);
+struct Expr;
+Expr* expr_compile(char* e);
+word_t expr_eval(const Expr* ex, bool* success);
+void expr_free(Expr* ex);
 
 
 #define NR_WP 32
@@ -56,6 +63,7 @@ void init_wp_pool();
 void wp_update();
 void wp_display();
 void wp_create(char* expr);
+void wp_create_mem(word_t addr, word_t len);
 void wp_delete(int NO);
 
 // Break point
@@ -69,6 +77,10 @@ void bp_delete(int NO);
 void init_ftrace(const char* elf_file);
 const char* ftrace_search(uint32_t pc, uint32_t* entry_addr);
 word_t ftrace_get_address_of(const char* name);
+void ftrace_call(uint32_t entry, bool is_tail, uint64_t icount);
+void ftrace_ret(uint32_t pc, uint64_t icount);
+int ftrace_depth();
+void ftrace_profile_display(uint64_t icount);
 
 enum class SDBState
 {
@@ -14,6 +14,7 @@
  ***************************************************************************************/
 
 #include <cstdlib>
+#include "dut_proxy.hpp"
 #include "sdb.hpp"
 
 typedef struct watchpoint
@@ -23,13 +24,38 @@ typedef struct watchpoint
   struct watchpoint* next;
 
   char* expr;
+  Expr* code;
   word_t last_val;
   bool last_val_valid;
+
+  // Memory watchpoints are checked by DUTMemory::write instead of wp_update().
+  bool is_mem;
+  word_t addr;
+  word_t len;
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = nullptr, *free_ = nullptr;
 
+static void wp_mem_hit(uint32_t addr, uint32_t wdata, uint8_t wmask);
+
+// Narrow DUTMemory's watched range to the union of all memory watchpoints,
+// so that an unwatched write costs only one compare.
+static void wp_mem_update_range()
+{
+  auto& mem = SIM.mem();
+  mem.watch_lo = UINT32_MAX;
+  mem.watch_hi = 0;
+  mem.write_watch = wp_mem_hit;
+  for (WP* p = head; p != nullptr; p = p->next)
+  {
+    if (!p->is_mem)
+      continue;
+    mem.watch_lo = std::min(mem.watch_lo, p->addr);
+    mem.watch_hi = std::max(mem.watch_hi, p->addr + p->len);
+  }
+}
+
 void init_wp_pool()
 {
   for (int i = 0; i < NR_WP; i++)
@@ -57,12 +83,17 @@ void free_wp(WP* wp)
   Assert(wp, "Watchpoint is nullptr");
 
   free(wp->expr);
+  wp->expr = nullptr;
+  expr_free(wp->code);
+  wp->code = nullptr;
 
   if (wp == head)
   {
     head = head->next;
     wp->next = free_;
     free_ = wp;
+    if (wp->is_mem)
+      wp_mem_update_range();
     return;
   }
 
@@ -73,6 +104,8 @@ void free_wp(WP* wp)
       p->next = wp->next;
       wp->next = free_;
       free_ = wp;
+      if (wp->is_mem)
+        wp_mem_update_range();
       return;
     }
   }
@@ -85,7 +118,7 @@ void wp_update_one(WP* p)
   if (!p->last_val_valid)
   {
     bool success;
-    p->last_val = expr(p->expr, &success);
+    p->last_val = expr_eval(p->code, &success);
     p->last_val_valid = success;
     if (!success)
       Log("Failed to evaluate '%s' for watchpoint %d.", p->expr, p->NO);
@@ -93,7 +126,7 @@ void wp_update_one(WP* p)
   }
 
   bool success;
-  word_t curr_val = expr(p->expr, &success);
+  word_t curr_val = expr_eval(p->code, &success);
   if (!success)
   {
     Log("Failed to evaluate '%s' for watchpoint %d.", p->expr, p->NO);
@@ -116,7 +149,30 @@ void wp_update_one(WP* p)
 void wp_update()
 {
   for (WP* p = head; p != nullptr; p = p->next)
-    wp_update_one(p);
+  {
+    if (!p->is_mem)
+      wp_update_one(p);
+  }
+}
+
+static void wp_mem_hit(uint32_t addr, uint32_t wdata, uint8_t wmask)
+{
+  for (WP* p = head; p != nullptr; p = p->next)
+  {
+    if (!p->is_mem)
+      continue;
+    bool hit = false;
+    for (int i = 0; i < 4; i++)
+      hit |= (wmask >> i & 1) && addr + i - p->addr < p->len;
+    if (!hit)
+      continue;
+    Log("Watchpoint %d: %s written at lsu_pc = " FMT_WORD ", addr = " FMT_WORD ", data = " FMT_WORD ", mask = 0x%x",
+        p->NO, p->expr, SIM.cpu().lsu_pc(), addr, wdata, wmask);
+    p->last_val = wdata;
+    p->last_val_valid = true;
+    if (sdb_state == SDBState::Running)
+      sdb_state = SDBState::Stop;
+  }
 }
 
 void wp_display()
@@ -133,13 +189,14 @@ void wp_display()
     if (p->last_val_valid)
       printf("%-6d 0x%-13x %s\n", p->NO, p->last_val, p->expr);
     else
-      printf("%-6d %-15s %s\n", p->NO, "Not evaluated", p->expr);
+      printf("%-6d %-15s %s\n", p->NO, p->is_mem ? "Not written" : "Not evaluated", p->expr);
   }
 }
 
 void wp_create(char* expr)
 {
-  if (!syntax_check(expr))
+  Expr* code = expr_compile(expr);
+  if (code == nullptr)
   {
     printf("Bad expression to watch: %s\n", expr);
     return;
@@ -147,6 +204,8 @@ void wp_create(char* expr)
 
   WP* p = new_wp();
   p->expr = strdup(expr);
+  p->code = code;
+  p->is_mem = false;
   p->last_val_valid = false;
   p->last_val = 0;
   printf("Watchpoint %d: %s\n", p->NO, p->expr);
@@ -154,3 +213,19 @@ void wp_create(char* expr)
 }
 
 void wp_delete(int NO) { free_wp(&wp_pool[NO]); }
+
+void wp_create_mem(word_t addr, word_t len)
+{
+  WP* p = new_wp();
+  char buf[64];
+  snprintf(buf, sizeof(buf), "[" FMT_WORD ", " FMT_WORD ")", addr, addr + len);
+  p->expr = strdup(buf);
+  p->code = nullptr;
+  p->is_mem = true;
+  p->addr = addr;
+  p->len = len;
+  p->last_val_valid = false;
+  p->last_val = 0;
+  wp_mem_update_range();
+  printf("Watchpoint %d: memory %s\n", p->NO, p->expr);
+}